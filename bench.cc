@@ -0,0 +1,254 @@
+#include "boilerplate.h"
+#include "walk.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+/*
+Benchmarks for the hot paths of the classification: loading a census, isosig
+computation, single moves, whole walks, merges, and the time it takes to
+connect a census into a single component.
+
+Every measurement is written to standard output as one tab-separated line
+
+	census	metric	value
+
+so that the output of two versions can be compared directly.  Runs use a
+fixed random seed and a single walker thread, so that two runs of the same
+build take the same walks.
+*/
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point since) {
+	return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+void report(const std::string& census, const char* metric, double value) {
+	std::cout << census << "\t" << metric << "\t" << value << std::endl;
+}
+
+/*
+# bench census: run all benchmarks on one census file
+#
+# file:		census file; should contain a single PL class, or the census
+#		can never become a single component
+# seed:		random seed, reset before each benchmark
+# timeout:	seconds to allow for reaching a single component
+# xx, scaling:	as in main.cc; balance is derived from the census as in main.cc
+#		unless given (i.e., unless positive)
+# beamWidth:	if positive, the time to a single component is also measured
+#		with beam searches of this width (see beam()) on a fresh copy
+#		of the census
+*/
+void benchCensus(const char* file, unsigned seed, int timeout, double xx, int balance, double scaling, int beamWidth) {
+	std::string name = file;
+	if (name.rfind('/') != std::string::npos)
+		name = name.substr(name.rfind('/') + 1);
+
+	// load
+	Clock::time_point start = Clock::now();
+	TriangulationSet census(file);
+	report(name, "load_seconds", seconds(start));
+	{
+		start = Clock::now();
+		TriangulationSet slow;
+		std::ifstream f(file);
+		slow.read(f);
+		report(name, "load_stream_seconds", seconds(start));
+	}
+	report(name, "triangulations", census.size());
+
+	// targets, as in main.cc
+	regina::Triangulation<4> first = census.components().rep();
+	targetVertices = std::max(1, (int)first.eulerCharTri());
+	targetPentachora = first.size();
+	if (balance <= 0)
+		balance = 2 * targetPentachora - 3;
+
+	// decode some triangulations to work with
+	std::vector<regina::Triangulation<4>> tris;
+	for (auto tri : census) {
+		tris.push_back(tri);
+		if (tris.size() == 200)
+			break;
+	}
+
+	// isosigs
+	size_t calls = 0, length = 0;
+	start = Clock::now();
+	while (calls < 5000) {
+		for (const auto& tri : tris)
+			length += tri.isoSig<regina::IsoSigEdgeDegrees<4>>().size();
+		calls += tris.size();
+	}
+	report(name, "isosig_per_second", calls / seconds(start));
+	report(name, "isosig_length", double(length) / calls);
+
+	// single moves
+	seedWalks(seed);
+	{
+		Tri4 state(first);
+		MoveIndex index;
+		int moves = 0;
+		start = Clock::now();
+		for ( ; moves < 20000; ++moves)
+			if (! perform(state,index,xx,beta(state.size(),balance,scaling),targetVertices,0,9999))
+				break;
+		report(name, "moves_per_second", moves / seconds(start));
+	}
+
+	// the cost of a single legal move, Pachner (2-4 and 3-3 moves) against
+	// collapse (edge collapses and 2-0 moves), each from a freshly refreshed
+	// index
+	{
+		double pachnerTime = 0, collapseTime = 0;
+		size_t pachner = 0, collapse = 0;
+		for (const auto& tri : tris) {
+			Tri4 state(tri);
+			MoveIndex index, mover;
+			index.refresh(state, true);
+			for (auto m : { MoveIndex::collapse, MoveIndex::threeThree, MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle, MoveIndex::twoFour })
+				for (const auto& c : index.candidates(m)) {
+					Tri4 copy = state;
+					mover.refresh(copy, true);
+					start = Clock::now();
+					bool ok = mover.apply(copy, m, c);
+					double t = seconds(start);
+					if (! ok)
+						continue;
+					if (m == MoveIndex::threeThree || m == MoveIndex::twoFour) {
+						pachnerTime += t;
+						++pachner;
+					} else {
+						collapseTime += t;
+						++collapse;
+					}
+				}
+		}
+		report(name, "pachner_move_us", pachner ? 1e6 * pachnerTime / pachner : -1);
+		report(name, "collapse_move_us", collapse ? 1e6 * collapseTime / collapse : -1);
+	}
+
+	// whole walks
+	seedWalks(seed);
+	{
+		int walks = 0;
+		start = Clock::now();
+		for (size_t i = 0; i < 20; ++i) {
+			regina::Triangulation<4> tri = tris[i % tris.size()];
+			step(tri,xx,balance,scaling,0,9999);
+			++walks;
+		}
+		report(name, "walks_per_second", walks / seconds(start));
+	}
+
+	// merges and representatives, on a copy that the walks below do not see
+	{
+		TriangulationSet copy(file);
+		std::vector<Component> comps;
+		for (Component c = copy.components(); c; ++c)
+			comps.push_back(c);
+		std::mt19937 rng(seed);
+		size_t merges = std::min<size_t>(100000, 4 * comps.size());
+		start = Clock::now();
+		for (size_t i = 0; i < merges; ++i)
+			copy.merge(comps[rng() % comps.size()], comps[rng() % comps.size()]);
+		report(name, "merge_ns", 1e9 * seconds(start) / merges);
+
+		start = Clock::now();
+		for (int i = 0; i < 1000; ++i)
+			copy.components().rep();
+		report(name, "rep_cached_us", 1e6 * seconds(start) / 1000);
+
+		copy.setRepCacheSize(0);
+		start = Clock::now();
+		for (int i = 0; i < 1000; ++i)
+			copy.components().rep();
+		report(name, "rep_uncached_us", 1e6 * seconds(start) / 1000);
+	}
+
+	// time to a single component, walking as in the last phase of main.cc
+	seedWalks(seed);
+	{
+		WalkPool pool(1, [&](WalkJob& job) {
+			return step(job.tri,xx,balance,scaling,0,9999);
+		});
+		start = Clock::now();
+		while (census.countComponents() > 1 && seconds(start) < timeout)
+			sweep(census, pool, 101, 1, [](const WalkJob&, bool) {});
+		report(name, "components_left", census.countComponents());
+		report(name, "single_component_seconds",
+			census.countComponents() == 1 ? seconds(start) : -1);
+	}
+
+	// the same with beam search instead of random walks
+	if (beamWidth <= 0)
+		return;
+	seedWalks(seed);
+	{
+		TriangulationSet fresh(file);
+		WalkPool pool(1, [&](WalkJob& job) {
+			return beam(job.tri,beamWidth,100,0,9999);
+		});
+		start = Clock::now();
+		while (fresh.countComponents() > 1 && seconds(start) < timeout)
+			sweep(fresh, pool, 101, 1, [](const WalkJob&, bool) {});
+		report(name, "beam_components_left", fresh.countComponents());
+		report(name, "beam_single_component_seconds",
+			fresh.countComponents() == 1 ? seconds(start) : -1);
+	}
+}
+
+void usage(const char* progName, const std::string& error = std::string()) {
+    if (!error.empty()) {
+        std::cerr << error << "\n\n";
+    }
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "      " << progName << " [ -s=seed ] [ -t=timeout ] [ -x=xx ] [ -b=balance ] [ -c=scaling ] [ -e=beamWidth ] [ census files ... ]\n";
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned seed = 1;
+    int timeout = 300;
+    double xx = 0.1;
+    int balance = 0;
+    double scaling = 1.0;
+    int beamWidth = 0;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-')
+            files.push_back(argv[i]);
+        else if (argv[i][1] == 's')
+            seed = std::stoul(argv[i] + 2);
+        else if (argv[i][1] == 't')
+            timeout = std::stoi(argv[i] + 2);
+        else if (argv[i][1] == 'x')
+            xx = std::stod(argv[i] + 2);
+        else if (argv[i][1] == 'b')
+            balance = std::stoi(argv[i] + 2);
+        else if (argv[i][1] == 'c')
+            scaling = std::stod(argv[i] + 2);
+        else if (argv[i][1] == 'e')
+            beamWidth = std::stoi(argv[i] + 2);
+        else
+            usage(argv[0], std::string("Invalid Option: ") + argv[i]);
+    }
+    if (files.empty()) {
+        // One PL class from each of the bundled censuses.
+        files = { "Census/2p-Sorted/2p-PL-S4.esig",
+            "Census/4p-Sorted/4p-PL-S3xS1.esig",
+            "Census/6p-Sorted/6p-PL-S2xS2.esig" };
+    }
+
+    std::cout << "census\tmetric\tvalue" << std::endl;
+    for (const char* f : files) {
+        try {
+            benchCensus(f, seed, timeout, xx, balance, scaling, beamWidth);
+        } catch (const std::exception& e) {
+            usage(argv[0], e.what());
+        }
+    }
+}
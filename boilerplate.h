@@ -1,61 +1,369 @@
+#pragma once
 
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
-#include <map>
+#include <functional>
+#include <istream>
+#include <list>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "triangulation/dim4.h"
 #include "triangulation/isosigtype.h"
 #include "triangulation/detail/isosig-impl.h"
+#include "diskindex.h"
+#include "fingerprint.h"
+#include "packedsig.h"
+#include "stats.h"
+
+class TriangulationSet;
+
+// Nodes and isosigs are identified by their position in order of insertion.
+using NodeId = uint32_t;
+constexpr NodeId noNode = NodeId(-1);
+
+/**
+ * Raw binary I/O of arrays, as used for checkpoints.  The format is that of
+ * the host machine, so checkpoints are only meant to be read back on the
+ * machine (or at least the architecture) that wrote them.
+ */
+template <typename T>
+void writeRaw(std::ostream& out, const T* data, size_t n) {
+    out.write(reinterpret_cast<const char*>(data), n * sizeof(T));
+}
+
+template <typename T>
+void readRaw(std::istream& in, T* data, size_t n) {
+    in.read(reinterpret_cast<char*>(data), n * sizeof(T));
+    if (! in)
+        throw std::runtime_error("Checkpoint is truncated");
+}
+
+/**
+ * Interned isosigs, stored as packed keys (see PackedSig) back to back in a
+ * single contiguous arena and indexed by an open-addressing hash table with
+ * linear probing.
+ *
+ * Isosigs are never removed, and each is identified by its position in
+ * order of insertion.
+ *
+ * For censuses too large for memory, the keys can be kept in a DiskSigIndex
+ * instead; see storeOnDisk().
+ */
+// Heavyweight class, do not copy!
+class SigStore {
+    private:
+        std::string arena_; // all keys, back to back
+        std::vector<size_t> offsets_ { 0 }; // key i is [offsets_[i], offsets_[i+1])
+        std::vector<uint32_t> hashes_; // (truncated) hash of each key
+        std::vector<NodeId> slots_; // hash table, with noNode for empty slots
+        size_t mask_ { 0 };
+        std::unique_ptr<DiskSigIndex> disk_; // replaces all of the above, if set
 
-class Node;
+    public:
+        SigStore() {
+            rehash(1024);
+        }
 
-using SigMap = std::map<std::string, Node*>;
+        /**
+         * Returns the number of isosigs in the store.
+         */
+        size_t size() const {
+            return disk_ ? disk_->size() : hashes_.size();
+        }
+
+        /**
+         * Keeps all keys in a DiskSigIndex with its files in the given
+         * directory from now on, using about budget bytes of memory at most
+         * for sorting and buffering.
+         *
+         * PRE: The store is empty.
+         */
+        void storeOnDisk(const std::string& dir, size_t budget) {
+            disk_ = std::make_unique<DiskSigIndex>(dir, budget);
+        }
+
+        /**
+         * Returns the index on disk that holds the keys, or null if they are
+         * held in memory.
+         */
+        DiskSigIndex* disk() const {
+            return disk_.get();
+        }
+
+        /**
+         * Returns the key of the isosig with the given ID.  The view is only
+         * valid until the next insertion.
+         */
+        std::string_view operator [] (NodeId id) const {
+            if (disk_)
+                return (*disk_)[id];
+            return std::string_view(arena_.data() + offsets_[id],
+                offsets_[id + 1] - offsets_[id]);
+        }
+
+        /**
+         * Returns the isosig with the given ID, as text.
+         */
+        std::string text(NodeId id) const {
+            return PackedSig::text((*this)[id]);
+        }
+
+        /**
+         * Returns the ID of the isosig with the given key, or noNode if it
+         * is not present.
+         */
+        NodeId find(std::string_view key) const {
+            return find(key, hash(key));
+        }
+
+        /**
+         * A variant of find() for callers that have already computed
+         * hash(key).
+         */
+        NodeId find(std::string_view key, uint32_t h) const {
+            if (disk_)
+                return disk_->find(key);
+            for (size_t i = h & mask_; ; i = (i + 1) & mask_) {
+                NodeId id = slots_[i];
+                if (id == noNode)
+                    return noNode;
+                if (hashes_[id] == h && (*this)[id] == key)
+                    return id;
+            }
+        }
+
+        /**
+         * Inserts the isosig with the given key and returns its new ID.
+         *
+         * PRE: The given isosig is not already in the store.
+         */
+        NodeId insert(std::string_view key) {
+            return insert(key, hash(key));
+        }
+
+        /**
+         * A variant of insert() for callers that have already computed
+         * hash(key).
+         */
+        NodeId insert(std::string_view key, uint32_t h) {
+            if (disk_)
+                return disk_->insert(key);
+
+            // Keep the load factor at most 1/2.
+            if (2 * (size() + 1) > slots_.size())
+                rehash(2 * slots_.size());
+
+            NodeId id = size();
+            arena_.append(key.data(), key.size());
+            offsets_.push_back(arena_.size());
+            hashes_.push_back(h);
+            place(id);
+            return id;
+        }
+
+        /**
+         * Prepares the store for the given number of isosigs whose keys
+         * have the given average length.
+         */
+        void reserve(size_t n, size_t avgLength) {
+            if (disk_)
+                return;
+            arena_.reserve(n * avgLength);
+            offsets_.reserve(n + 1);
+            hashes_.reserve(n);
+            size_t want = slots_.size();
+            while (want < 2 * n)
+                want <<= 1;
+            if (want > slots_.size())
+                rehash(want);
+        }
+
+        /**
+         * Writes all keys to the given binary stream.
+         */
+        void save(std::ostream& out) const {
+            if (disk_)
+                return disk_->save(out);
+            uint64_t n = size(), len = arena_.size();
+            writeRaw(out, &n, 1);
+            writeRaw(out, &len, 1);
+            writeRaw(out, arena_.data(), len);
+            writeRaw(out, offsets_.data(), n + 1);
+        }
+
+        /**
+         * Replaces the contents of the store with keys read from the given
+         * binary stream, as written by save().  IDs are preserved.
+         */
+        void load(std::istream& in) {
+            if (disk_)
+                return disk_->load(in);
+            uint64_t n, len;
+            readRaw(in, &n, 1);
+            readRaw(in, &len, 1);
+            arena_.resize(len);
+            readRaw(in, &arena_[0], len);
+            offsets_.resize(n + 1);
+            readRaw(in, offsets_.data(), n + 1);
+            if (offsets_[0] != 0 || offsets_[n] != len)
+                throw std::runtime_error("Checkpoint is corrupt");
+
+            // Hashes are not stored, since they need not agree between builds.
+            hashes_.resize(n);
+            for (NodeId id = 0; id < n; ++id)
+                hashes_[id] = hash((*this)[id]);
+            size_t nSlots = 1024;
+            while (nSlots < 2 * n)
+                nSlots <<= 1;
+            rehash(nSlots);
+        }
+
+        /**
+         * The hash used to index keys.  This is a pure function of the key,
+         * and so may be computed on any thread.
+         */
+        static uint32_t hash(std::string_view key) {
+            uint64_t h = PackedSig::hash(key);
+            return uint32_t(h ^ (h >> 32));
+        }
+
+        SigStore(const SigStore&) = delete;
+        SigStore& operator = (const SigStore&) = delete;
 
-// Union-find support:
-class Node {
     private:
-        // Union-find parent node:
-        Node* parent_ { nullptr };
 
-        // Data that is only maintained for the component root:
-        size_t depth_ { 0 };
-        size_t size_ { 1 };
-        Node* prevComp_ { nullptr }; // root node for previous component
-        Node* nextComp_ { nullptr }; // root node for next component
-        SigMap::iterator rep_; // preferred representative triangulation
+        void place(NodeId id) {
+            size_t i = hashes_[id] & mask_;
+            while (slots_[i] != noNode)
+                i = (i + 1) & mask_;
+            slots_[i] = id;
+        }
 
+        void rehash(size_t nSlots) {
+            slots_.assign(nSlots, noNode);
+            mask_ = nSlots - 1;
+            for (NodeId id = 0; id < size(); ++id)
+                place(id);
+        }
+};
+
+/**
+ * A bounded cache of triangulations decoded from isosigs, keyed by node and
+ * evicting the least recently used entry once full.
+ *
+ * Entries are handed out as shared handles, so an evicted triangulation
+ * stays alive for as long as somebody still holds it.
+ */
+// Heavyweight class, do not copy!
+class RepCache {
     public:
-        Node() = default;
+        using Handle = std::shared_ptr<const regina::Triangulation<4>>;
+
+    private:
+        using Entry = std::pair<NodeId, Handle>;
+
+        std::list<Entry> lru_; // most recently used first
+        std::unordered_map<NodeId, std::list<Entry>::iterator> index_;
+        size_t capacity_;
+
+    public:
+        RepCache(size_t capacity = 16384) : capacity_(capacity) {}
 
         /**
-         * Find the root node (i.e., the "canonical" representative) for the
-         * component containing this node.
+         * Returns the triangulation for the given node, decoding the isosig
+         * with the given key only if the node is not already cached.
          */
-        Node* root() {
-            if (! parent_)
-                return this;
+        Handle get(NodeId id, std::string_view key) {
+            auto pos = index_.find(id);
+            if (pos != index_.end()) {
+                lru_.splice(lru_.begin(), lru_, pos->second);
+                return pos->second->second;
+            }
 
-            // This is a non-root node.
+            Handle ans = std::make_shared<const regina::Triangulation<4>>(
+                regina::Triangulation<4>::fromIsoSig(PackedSig::text(key)));
+            if (capacity_ == 0)
+                return ans;
+            if (lru_.size() >= capacity_) {
+                index_.erase(lru_.back().first);
+                lru_.pop_back();
+            }
+            lru_.emplace_front(id, ans);
+            index_.emplace(id, lru_.begin());
+            return ans;
+        }
 
-            // Find the root.
-            Node* root = parent_;
-            while (root->parent_)
-                root = root->parent_;
+        /**
+         * Returns the cached triangulation for the given node, or null if it
+         * is not cached.  This does not count as a use of the entry.
+         */
+        Handle peek(NodeId id) const {
+            auto pos = index_.find(id);
+            return (pos == index_.end() ? nullptr : pos->second->second);
+        }
 
-            // Compress the tree - adjust all nodes on the path from this node
-            // to the root so that their parents point directly to the root.
-            Node* n = this;
-            while (n->parent_ != root) {
-                Node* tmp = n->parent_;
-                n->parent_ = root;
-                n = tmp;
+        /**
+         * Forgets the given node, if it is cached.
+         */
+        void drop(NodeId id) {
+            auto pos = index_.find(id);
+            if (pos != index_.end()) {
+                lru_.erase(pos->second);
+                index_.erase(pos);
             }
+        }
 
-            return root;
+        /**
+         * Forgets all cached triangulations.
+         */
+        void clear() {
+            lru_.clear();
+            index_.clear();
         }
 
-        // Make nodes non-copyable.
-        Node(const Node&) = delete;
-        Node& operator = (const Node&) = delete;
+        /**
+         * Changes the maximum number of cached triangulations, evicting
+         * entries if necessary.  A capacity of zero disables the cache.
+         */
+        void setCapacity(size_t capacity) {
+            capacity_ = capacity;
+            while (lru_.size() > capacity_) {
+                index_.erase(lru_.back().first);
+                lru_.pop_back();
+            }
+        }
+
+        RepCache(const RepCache&) = delete;
+        RepCache& operator = (const RepCache&) = delete;
+};
+
+// Union-find support:
+class Node {
+    private:
+        // Union-find parent node:
+        NodeId parent_ { noNode };
+
+        // Data that is only maintained for the component root:
+        uint32_t size_ { 1 };
+        uint8_t depth_ { 0 };
+        NodeId prevComp_ { noNode }; // root node for previous component
+        NodeId nextComp_ { noNode }; // root node for next component
+        NodeId rep_; // preferred representative triangulation
+
+    public:
+        Node(NodeId rep) : rep_(rep) {}
 
     friend class Component;
     friend class TriangulationSet;
@@ -64,14 +372,16 @@ class Node {
 // Lightweight class, cheap and safe to copy
 class Component {
     private:
+        const TriangulationSet* set_ { nullptr };
+
         /**
          * This may be any node within the component (since merges could
          * turn roots into non-roots and we do not want to have to update
          * existing Component objects to account for this).
          *
-         * This is null for a past-the-end component (for iteration).
+         * This is noNode for a past-the-end component (for iteration).
          */
-        Node* comp_ { nullptr };
+        NodeId comp_ { noNode };
 
     private:
         /**
@@ -81,21 +391,19 @@ class Component {
          *
          * PRE: This is not a past-the-end component.
          */
-        void makeRoot() const {
-            while (comp_->parent_)
-                const_cast<Component*>(this)->comp_ = comp_->parent_;
-        }
+        inline void makeRoot() const;
 
     public:
         Component() = default;
-        Component(Node* comp) : comp_(comp) {}
+        Component(const TriangulationSet* set, NodeId comp) :
+            set_(set), comp_(comp) {}
         Component& operator = (const Component&) = default;
 
         /**
          * Returns true iff this is not a past-the-end component.
          */
         operator bool() const {
-            return comp_;
+            return comp_ != noNode;
         }
 
         /**
@@ -103,9 +411,9 @@ class Component {
          * component.  Past-the-end components are allowed.
          */
         bool operator == (const Component& other) const {
-            if (comp_)
+            if (comp_ != noNode)
                 makeRoot();
-            if (other.comp_)
+            if (other.comp_ != noNode)
                 other.makeRoot();
             return (comp_ == other.comp_);
         }
@@ -115,11 +423,7 @@ class Component {
          * same component.  Past-the-end components are allowed.
          */
         bool operator != (const Component& other) const {
-            if (comp_)
-                makeRoot();
-            if (other.comp_)
-                other.makeRoot();
-            return (comp_ != other.comp_);
+            return ! (*this == other);
         }
 
         /**
@@ -127,19 +431,42 @@ class Component {
          *
          * PRE: This is not a past-the-end component.
          */
-        size_t size() const {
-            makeRoot();
-            return comp_->size_;
-        }
+        inline size_t size() const;
 
         /**
          * Returns the "canonical" representative for this component.
          *
          * PRE: This is not a past-the-end component.
          */
-        regina::Triangulation<4> rep() const {
+        inline regina::Triangulation<4> rep() const;
+
+        /**
+         * Returns a shared read-only handle to the "canonical" representative
+         * for this component.  This avoids the copy made by rep(), and
+         * remains valid even if the component later changes representative.
+         *
+         * PRE: This is not a past-the-end component.
+         */
+        inline RepCache::Handle repHandle() const;
+
+        /**
+         * Returns the isosig of the "canonical" representative for this
+         * component, without decoding it.
+         *
+         * PRE: This is not a past-the-end component.
+         */
+        inline std::string repSig() const;
+
+        /**
+         * Returns the root node of this component.  This identifies the
+         * component for as long as it is not merged with another; after a
+         * merge, at most one of the two old roots is still the root.
+         *
+         * PRE: This is not a past-the-end component.
+         */
+        NodeId root() const {
             makeRoot();
-            return regina::Triangulation<4>::fromIsoSig(comp_->rep_->first);
+            return comp_;
         }
 
         /**
@@ -148,11 +475,7 @@ class Component {
          *
          * PRE: This is not a past-the-end component.
          */
-        Component& operator ++ () {
-            makeRoot();
-            comp_ = comp_->nextComp_;
-            return *this;
-        }
+        inline Component& operator ++ ();
 
         /**
          * Postincrement operator that advances this to point to the
@@ -162,8 +485,8 @@ class Component {
          */
         Component operator ++ (int) {
             makeRoot();
-            Component ans(comp_);
-            comp_ = comp_->nextComp_;
+            Component ans(*this);
+            ++*this;
             return ans;
         }
 
@@ -173,11 +496,7 @@ class Component {
          *
          * PRE: This is not a past-the-end component.
          */
-        Component& operator -- () {
-            makeRoot();
-            comp_ = comp_->prevComp_;
-            return *this;
-        }
+        inline Component& operator -- ();
 
         /**
          * Postincrement operator that "reverse advances" this to point to the
@@ -187,8 +506,8 @@ class Component {
          */
         Component operator -- (int) {
             makeRoot();
-            Component ans(comp_);
-            comp_ = comp_->prevComp_;
+            Component ans(*this);
+            --*this;
             return ans;
         }
 
@@ -198,78 +517,159 @@ class Component {
 // Heavyweight class, do not copy!
 class TriangulationSet {
     private:
-        SigMap nodes_;
+        SigStore sigs_;
+        MappedArray<Node> nodes_; // indexed by the same IDs as sigs_
         size_t components_ { 0 };
-        Node* firstComp_ { nullptr };
-        Node* lastComp_ { nullptr };
+        NodeId firstComp_ { noNode };
+        NodeId lastComp_ { noNode };
+        mutable RepCache cache_; // decoded representatives
+        FingerprintFilter filter_; // fingerprints of all entries, if indexed
+        size_t resident_ { 0 }; // limit on the resident set, if kept on disk
+        uint32_t untrimmed_ { 0 }; // operations since trim() last checked
+        uint32_t trimEvery_ { 64 }; // operations between checks
+        uint32_t maxTrimEvery_ { 4096 }; // operations between checks, at most
 
     private:
         class iterator {
             private:
-                SigMap::const_iterator mapIt_;
+                const TriangulationSet* set_ { nullptr };
+                NodeId id_ { 0 };
 
             public:
                 iterator() = default;
                 iterator(const iterator&) = default;
-                iterator(SigMap::const_iterator mapIt) : mapIt_(mapIt) {}
+                iterator(const TriangulationSet* set, NodeId id) :
+                    set_(set), id_(id) {}
 
                 iterator& operator = (const iterator&) = default;
 
                 bool operator == (const iterator& rhs) const {
-                    return mapIt_ == rhs.mapIt_;
+                    return id_ == rhs.id_;
                 }
 
                 bool operator != (const iterator& rhs) const {
-                    return mapIt_ != rhs.mapIt_;
+                    return id_ != rhs.id_;
                 }
 
                 regina::Triangulation<4> operator * () const {
-                    return regina::Triangulation<4>::fromIsoSig(mapIt_->first);
+                    // Use a cached copy if this happens to be a representative,
+                    // but do not fill the cache with every triangulation in
+                    // the set.
+                    if (auto cached = set_->cache_.peek(id_))
+                        return *cached;
+                    return regina::Triangulation<4>::fromIsoSig(
+                        set_->sigs_.text(id_));
                 }
 
                 iterator& operator ++ () {
-                    ++mapIt_;
+                    ++id_;
                     return *this;
                 }
 
                 iterator operator ++ (int) {
                     iterator ans = *this;
-                    ++mapIt_;
+                    ++id_;
                     return ans;
                 }
 
                 iterator& operator -- () {
-                    --mapIt_;
+                    --id_;
                     return *this;
                 }
 
                 iterator operator -- (int) {
                     iterator ans = *this;
-                    --mapIt_;
+                    --id_;
                     return ans;
                 }
         };
 
     private:
+        static bool isSpace(char c) {
+            return c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+                c == '\v' || c == '\f';
+        }
+
+        /**
+         * Find the root node (i.e., the "canonical" representative) for the
+         * component containing the given node.
+         */
+        NodeId root(NodeId id) {
+            // Find the root.
+            NodeId root = id;
+            while (nodes_[root].parent_ != noNode)
+                root = nodes_[root].parent_;
+
+            // Compress the tree - adjust all nodes on the path from this node
+            // to the root so that their parents point directly to the root.
+            while (id != root && nodes_[id].parent_ != root) {
+                NodeId tmp = nodes_[id].parent_;
+                nodes_[id].parent_ = root;
+                id = tmp;
+            }
+
+            return root;
+        }
+
         /**
-         * Inserts a the given isosig into the set, as an isolated component.
+         * Inserts the isosig with the given key into the set, as an isolated
+         * component.
          *
          * PRE: The given isosig is not already in the set.
          */
-        Node* createNode(std::string&& sig) {
-            Node* n = new Node();
-            n->rep_ = nodes_.emplace(std::move(sig), n).first;
+        NodeId createNode(std::string_view key) {
+            return createNode(key, SigStore::hash(key));
+        }
+
+        /**
+         * A variant of createNode() for callers that have already computed
+         * SigStore::hash(key).
+         */
+        NodeId createNode(std::string_view key, uint32_t h) {
+            NodeId n = sigs_.insert(key, h);
+            addNode(n);
+            return n;
+        }
 
-            n->prevComp_ = lastComp_;
-            if (lastComp_)
-                lastComp_->nextComp_ = n;
+        /**
+         * Adds the node for the isosig with the given ID, which must be the
+         * next ID, as an isolated component.
+         */
+        void addNode(NodeId n) {
+            nodes_.emplace_back(n);
+
+            nodes_[n].prevComp_ = lastComp_;
+            if (lastComp_ != noNode)
+                nodes_[lastComp_].nextComp_ = n;
             else
                 firstComp_ = n;
             lastComp_ = n;
 
             ++components_;
+            trim();
+        }
 
-            return n;
+        /**
+         * If this set is kept on disk, checks every so often whether the
+         * resident set has outgrown its limit, and if so takes the pages of
+         * all files out of it.
+         *
+         * Checks become more frequent whenever the limit has been exceeded,
+         * and less frequent again while it has not, but there are never so
+         * many operations between checks that the pages they touch (a few
+         * per operation) could add up to more than a fraction of the limit.
+         */
+        void trim() {
+            if (resident_ == 0 || ++untrimmed_ < trimEvery_)
+                return;
+            untrimmed_ = 0;
+            if (residentBytes() > resident_) {
+                if (sigs_.disk())
+                    sigs_.disk()->drop();
+                nodes_.drop();
+                trimEvery_ = std::max<uint32_t>(trimEvery_ / 2, 16);
+            } else
+                trimEvery_ = std::min(trimEvery_ * 2, maxTrimEvery_);
         }
 
         /**
@@ -277,13 +677,21 @@ class TriangulationSet {
          * If the triangulation is not already in the set, it will be inserted
          * as a new isolated component.
          */
-        Node* node(const regina::Triangulation<4>& tri) {
-            auto sig = tri.isoSig<regina::IsoSigEdgeDegrees<4>>();
-            auto pos = nodes_.find(sig);
-            if (pos == nodes_.end())
-                return createNode(std::move(sig));
-            else
-                return pos->second;
+        NodeId node(const regina::Triangulation<4>& tri) {
+            PackedSig sig;
+            {
+                STATS_COUNT(statIsoSigs);
+                STATS_TIME(statTimeIsoSig);
+                sig = tri.isoSig<regina::IsoSigEdgeDegrees<4>,
+                    PackedSigEncoding<4>>();
+            }
+            NodeId pos = sigs_.find(sig.key());
+            if (pos == noNode) {
+                if (filter_.enabled())
+                    filter_.add(fingerprint(Tri4(tri)));
+                return createNode(sig.key());
+            } else
+                return pos;
         }
 
         /**
@@ -301,32 +709,36 @@ class TriangulationSet {
          * - the merged component will use the preferred representative from n1
          *   if useRep1 is true, or from n2 if useRep1 is false.
          */
-        bool merge(Node* n1, Node* n2, bool useRep1) {
-            n1 = n1->root();
-            n2 = n2->root();
-            if (n1 == n2)
+        bool merge(NodeId id1, NodeId id2, bool useRep1) {
+            STATS_COUNT(statMerges);
+            STATS_TIME(statTimeMerge);
+            trim();
+            id1 = root(id1);
+            id2 = root(id2);
+            if (id1 == id2)
                 return false;
+            STATS_COUNT(statMergesJoined);
+
+            Node* n1 = &nodes_[id1];
+            Node* n2 = &nodes_[id2];
+
+            // Whichever representative is not kept will most likely never be
+            // asked for again.
+            cache_.drop(useRep1 ? n2->rep_ : n1->rep_);
 
             if (n1->depth_ > n2->depth_) {
                 // Make n1 the root for both components.
-                n2->parent_ = n1;
+                n2->parent_ = id1;
                 n1->size_ += n2->size_;
 
                 // Remove the old root n2 from the linked list of components.
-                if (n2->prevComp_)
-                    n2->prevComp_->nextComp_ = n2->nextComp_;
-                else
-                    firstComp_ = n2->nextComp_;
-                if (n2->nextComp_)
-                    n2->nextComp_->prevComp_ = n2->prevComp_;
-                else
-                    lastComp_ = n2->prevComp_;
+                unlink(id2);
 
                 if (! useRep1)
                     n1->rep_ = n2->rep_;
             } else {
                 // Make n2 the root for both components.
-                n1->parent_ = n2;
+                n1->parent_ = id2;
                 n2->size_ += n1->size_;
                 if (n1->depth_ == n2->depth_)
                     ++n2->depth_;
@@ -337,31 +749,24 @@ class TriangulationSet {
                 // could be adjacent in the list.
 
                 // First, remove n2 from the list:
-                if (n2->prevComp_)
-                    n2->prevComp_->nextComp_ = n2->nextComp_;
-                else
-                    firstComp_ = n2->nextComp_;
-                if (n2->nextComp_)
-                    n2->nextComp_->prevComp_ = n2->prevComp_;
-                else
-                    lastComp_ = n2->prevComp_;
+                unlink(id2);
 
                 // Next, adjust the neighbours of n1 to point to n2 instead
                 // (and vice versa).
-                if (n1->prevComp_) {
-                    n1->prevComp_->nextComp_ = n2;
+                if (n1->prevComp_ != noNode) {
+                    nodes_[n1->prevComp_].nextComp_ = id2;
                     n2->prevComp_ = n1->prevComp_;
                 } else {
-                    firstComp_ = n2;
-                    n2->prevComp_ = nullptr;
+                    firstComp_ = id2;
+                    n2->prevComp_ = noNode;
                 }
 
-                if (n1->nextComp_) {
-                    n1->nextComp_->prevComp_ = n2;
+                if (n1->nextComp_ != noNode) {
+                    nodes_[n1->nextComp_].prevComp_ = id2;
                     n2->nextComp_ = n1->nextComp_;
                 } else {
-                    lastComp_ = n2;
-                    n2->nextComp_ = nullptr;
+                    lastComp_ = id2;
+                    n2->nextComp_ = noNode;
                 }
 
                 if (useRep1)
@@ -372,7 +777,52 @@ class TriangulationSet {
             return true;
         }
 
+        /**
+         * Removes the given root node from the linked list of components.
+         */
+        void unlink(NodeId id) {
+            Node& n = nodes_[id];
+            if (n.prevComp_ != noNode)
+                nodes_[n.prevComp_].nextComp_ = n.nextComp_;
+            else
+                firstComp_ = n.nextComp_;
+            if (n.nextComp_ != noNode)
+                nodes_[n.nextComp_].prevComp_ = n.prevComp_;
+            else
+                lastComp_ = n.prevComp_;
+        }
+
     public:
+        /**
+         * Creates an empty set.  This is mainly useful as a target for load().
+         */
+        TriangulationSet() = default;
+
+        /**
+         * Keeps the isosigs and the union-find state of this set on disk
+         * from now on, for censuses too large for memory.  The files (see
+         * DiskSigIndex, plus a file nodes for the union-find) go in the
+         * given directory, which must already exist, and are scratch space
+         * for this run only.
+         *
+         * The resident set of the process is kept to about maxResident
+         * bytes: a quarter of this is used to sort and buffer isosigs, and
+         * pages of the files are handed back to the kernel whenever the
+         * process outgrows the limit.  Decoded representatives and
+         * fingerprints are still kept in memory (see setRepCacheSize()).
+         *
+         * This routine throws std::runtime_error if the files cannot be
+         * created.
+         *
+         * PRE: The set is empty.
+         */
+        void storeOnDisk(const std::string& dir, size_t maxResident) {
+            sigs_.storeOnDisk(dir, maxResident / 4);
+            nodes_.open(dir + "/nodes");
+            resident_ = maxResident;
+            maxTrimEvery_ = std::clamp<size_t>(maxResident >> 17, 16, 4096);
+        }
+
         /**
          * Reads in a triangulation set from the given file.
          *
@@ -382,28 +832,219 @@ class TriangulationSet {
          *
          * Each triangulation will become an isolated component.
          *
-         * This routine should throw an exception if the file is unreadable.
-         * If some piece of text is not a valid isosig, an exception will most
-         * likely be thrown but possibly not until much later (when the isosig
-         * is actually fleshed out into a real triangulation).
+         * This routine throws std::runtime_error if the file is unreadable,
+         * or if some piece of text contains characters that cannot appear in
+         * an isosig.  Other invalid isosigs will most likely cause an
+         * exception, but possibly not until much later (when the isosig is
+         * actually fleshed out into a real triangulation).
+         *
+         * See read() for the meaning of threads.
          */
-        TriangulationSet(const char* filename) {
-            std::ifstream f(filename);
+        TriangulationSet(const char* filename, unsigned threads = 1) {
+            read(filename, threads);
+        }
+
+        /**
+         * Adds the isosigs in the given file to the set, in the same way as
+         * the constructor above.  Isosigs are numbered in the order in which
+         * they appear, and isosigs already in the set (including repeats
+         * within the file) are skipped.
+         *
+         * The file is memory-mapped and split into isosigs in place.  If
+         * threads is greater than 1, the file is split into that many pieces,
+         * which are tokenised, packed and hashed in parallel before being
+         * inserted in order.
+         *
+         * If the set is kept on disk (see storeOnDisk()) then the file is
+         * instead read a piece at a time, and if the set is empty then the
+         * isosigs are numbered in sorted order (see DiskSigIndex::build()).
+         *
+         * Returns the number of isosigs that were skipped as duplicates.
+         */
+        size_t read(const char* filename, unsigned threads = 1) {
+            if (sigs_.disk()) {
+                if (size() == 0) {
+                    size_t duplicates = sigs_.disk()->build(filename);
+                    nodes_.reserve(sigs_.size());
+                    for (NodeId id = 0; id < sigs_.size(); ++id)
+                        addNode(id);
+                    return duplicates;
+                }
+                std::ifstream f(filename);
+                if (! f)
+                    throw std::runtime_error(std::string("Cannot read ") +
+                        filename + ": " + std::strerror(errno));
+                return read(f);
+            }
+
+            int fd = ::open(filename, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || ::fstat(fd, &st) != 0) {
+                if (fd >= 0)
+                    ::close(fd);
+                throw std::runtime_error(std::string("Cannot read ") +
+                    filename + ": " + std::strerror(errno));
+            }
+            size_t len = st.st_size;
+            if (len == 0) {
+                ::close(fd);
+                return 0;
+            }
+            void* map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                // Not something we can map (e.g., a pipe); read it the
+                // slow way instead.
+                std::ifstream f(filename);
+                return read(f);
+            }
+            ::madvise(map, len, MADV_SEQUENTIAL);
+            const char* data = static_cast<const char*>(map);
+
+            // Split the file into pieces that start and end on whitespace.
+            if (threads < 1)
+                threads = 1;
+            std::vector<size_t> cut(threads + 1, len);
+            cut[0] = 0;
+            for (unsigned i = 1; i < threads; ++i) {
+                size_t c = std::max(cut[i - 1], len * i / threads);
+                while (c < len && ! isSpace(data[c]))
+                    ++c;
+                cut[i] = c;
+            }
+
+            // Keys of each piece, back to back, with the end and hash of each.
+            using Token = std::pair<size_t, uint32_t>;
+            std::vector<std::string> keys(threads);
+            std::vector<std::vector<Token>> tokens(threads);
+            std::vector<std::string> bad(threads); // first invalid isosig
+            auto tokenise = [&](unsigned i) {
+                const char* p = data + cut[i];
+                const char* end = data + cut[i + 1];
+                while (true) {
+                    while (p < end && isSpace(*p))
+                        ++p;
+                    if (p == end)
+                        break;
+                    const char* start = p;
+                    while (p < end && ! isSpace(*p))
+                        ++p;
+                    std::string_view sig(start, p - start);
+                    size_t from = keys[i].size();
+                    if (! PackedSig::pack(sig, keys[i])) {
+                        bad[i] = sig;
+                        return;
+                    }
+                    tokens[i].emplace_back(keys[i].size(), SigStore::hash(
+                        std::string_view(keys[i]).substr(from)));
+                }
+            };
+            if (threads == 1)
+                tokenise(0);
+            else {
+                std::vector<std::thread> pool;
+                for (unsigned i = 0; i < threads; ++i)
+                    pool.emplace_back(tokenise, i);
+                for (auto& t : pool)
+                    t.join();
+            }
+
+            ::munmap(map, len);
+            for (const std::string& b : bad)
+                if (! b.empty())
+                    throw std::runtime_error(std::string(filename) +
+                        " contains something that is not an isosig: " + b);
+
+            size_t n = 0, bytes = 0;
+            for (unsigned i = 0; i < threads; ++i) {
+                n += tokens[i].size();
+                bytes += keys[i].size();
+            }
+            sigs_.reserve(sigs_.size() + n, n ? (bytes / n) : 0);
+            nodes_.reserve(nodes_.size() + n);
+
+            size_t duplicates = 0;
+            for (unsigned i = 0; i < threads; ++i) {
+                size_t from = 0;
+                for (const Token& tok : tokens[i]) {
+                    std::string_view key = std::string_view(keys[i]).substr(
+                        from, tok.first - from);
+                    from = tok.first;
+                    if (sigs_.find(key, tok.second) == noNode)
+                        createNode(key, tok.second);
+                    else
+                        ++duplicates;
+                }
+            }
+            return duplicates;
+        }
 
+        /**
+         * Adds the isosigs in the given stream to the set, one at a time.
+         * This is the fallback for files that cannot be memory-mapped.
+         *
+         * Returns the number of isosigs that were skipped as duplicates.
+         */
+        size_t read(std::istream& f) {
+            size_t duplicates = 0;
+            std::string key;
             while (true) {
                 std::string sig;
                 f >> sig;
                 if (! f)
                     break;
-                if (sig.size() > 0) {
-                    createNode(std::move(sig));
+                key.clear();
+                if (! PackedSig::pack(sig, key))
+                    throw std::runtime_error("Not an isosig: " + sig);
+                if (sig.size() > 0 && sigs_.find(key) == noNode) {
+                    createNode(key);
 
                     // Old code that converted classic isosigs to edge degree
                     // isosigs:
                     // auto tri = regina::Triangulation<4>::fromIsoSig(sig);
                     // createNode(tri.isoSig<regina::IsoSigEdgeDegrees<4>>());
-                }
+                } else
+                    ++duplicates;
             }
+            return duplicates;
+        }
+
+        /**
+         * Adds the isosigs in the given file to the set as a single
+         * component, for a class of triangulations that are already known
+         * to be connected (such as one of the sorted class files in
+         * Census/), so that the connections need not be found again.  The
+         * first isosig in the file becomes the preferred representative.
+         *
+         * Isosigs that are already in the set are merged along with the
+         * rest, and so two files that share an isosig end up as a single
+         * component.
+         *
+         * Returns the component, or a past-the-end component if the file
+         * holds no isosigs.  Throws std::runtime_error if the file is
+         * unreadable, or if it contains something that is not an isosig.
+         */
+        Component readComponent(const char* filename) {
+            std::ifstream f(filename);
+            if (! f)
+                throw std::runtime_error(std::string("Cannot read ") +
+                    filename + ": " + std::strerror(errno));
+            NodeId first = noNode;
+            std::string sig, key;
+            while (f >> sig) {
+                key.clear();
+                if (! PackedSig::pack(sig, key))
+                    throw std::runtime_error(std::string(filename) +
+                        " contains something that is not an isosig: " + sig);
+                NodeId id = sigs_.find(key);
+                if (id == noNode)
+                    id = createNode(key);
+                if (first == noNode)
+                    first = id;
+                else
+                    merge(first, id, true);
+            }
+            return Component(this, first);
         }
 
         /**
@@ -438,6 +1079,181 @@ class TriangulationSet {
             return merge(c.comp_, node(t2), useRep1);
         }
 
+        /**
+         * A variant of merge() that takes two components.
+         *
+         * PRE: Neither c1 nor c2 is a past-the-end component.
+         */
+        bool merge(Component c1, Component c2, bool useRep1 = true) {
+            return merge(c1.comp_, c2.comp_, useRep1);
+        }
+
+        /**
+         * A variant of merge() that takes the isosig of the second
+         * triangulation instead of the triangulation itself, for callers
+         * that already have the isosig (e.g., from another process).  As
+         * with merge(), the isosig is inserted if it is not yet in the set.
+         *
+         * PRE: c is not a past-the-end component.
+         */
+        bool mergeSig(Component c, std::string_view sig, bool useRep1 = true) {
+            PackedSig key(sig);
+            NodeId pos = sigs_.find(key.key());
+            if (pos == noNode) {
+                if (filter_.enabled())
+                    filter_.add(fingerprint(Tri4(
+                        regina::Triangulation<4>::fromIsoSig(std::string(sig)))));
+                pos = createNode(key.key());
+            }
+            return merge(c.comp_, pos, useRep1);
+        }
+
+        /**
+         * Merges the component c with the component containing the given
+         * isosig, but only if that isosig is already in the set; unlike
+         * merge(), nothing new is ever inserted.
+         *
+         * Returns true if two distinct components were merged, or false if
+         * the isosig is not in the set or already belongs to c.
+         *
+         * PRE: c is not a past-the-end component.
+         */
+        bool mergeIfPresent(Component c, std::string_view sig,
+                bool useRep1 = true) {
+            std::string key;
+            if (! PackedSig::pack(sig, key))
+                return false;
+            NodeId pos = sigs_.find(key);
+            if (pos == noNode)
+                return false;
+            return merge(c.comp_, pos, useRep1);
+        }
+
+        /**
+         * Writes the isosigs and the full union-find state (parents,
+         * component sizes and order, and preferred representatives) to the
+         * given binary stream.  Decoded representatives and fingerprints
+         * are not saved.
+         */
+        void save(std::ostream& out) const {
+            sigs_.save(out);
+
+            uint64_t n = nodes_.size();
+            std::vector<NodeId> ids(n);
+            std::vector<uint32_t> sizes(n);
+            std::vector<uint8_t> depths(n);
+            for (NodeId id = 0; id < n; ++id) {
+                sizes[id] = nodes_[id].size_;
+                depths[id] = nodes_[id].depth_;
+            }
+            writeRaw(out, sizes.data(), n);
+            writeRaw(out, depths.data(), n);
+            for (NodeId Node::* field : { &Node::parent_, &Node::prevComp_,
+                    &Node::nextComp_, &Node::rep_ }) {
+                for (NodeId id = 0; id < n; ++id)
+                    ids[id] = nodes_[id].*field;
+                writeRaw(out, ids.data(), n);
+            }
+
+            uint64_t components = components_;
+            writeRaw(out, &components, 1);
+            writeRaw(out, &firstComp_, 1);
+            writeRaw(out, &lastComp_, 1);
+        }
+
+        /**
+         * Replaces the contents of this set with a set read from the given
+         * binary stream, as written by save().  Any fingerprints will need
+         * to be indexed again.
+         *
+         * Throws std::runtime_error if the data is truncated or corrupt.
+         */
+        void load(std::istream& in) {
+            sigs_.load(in);
+
+            uint64_t n = sigs_.size();
+            std::vector<NodeId> ids(n);
+            std::vector<uint32_t> sizes(n);
+            std::vector<uint8_t> depths(n);
+            readRaw(in, sizes.data(), n);
+            readRaw(in, depths.data(), n);
+            nodes_.assign(n, Node(noNode));
+            for (NodeId id = 0; id < n; ++id) {
+                nodes_[id].size_ = sizes[id];
+                nodes_[id].depth_ = depths[id];
+            }
+            for (NodeId Node::* field : { &Node::parent_, &Node::prevComp_,
+                    &Node::nextComp_, &Node::rep_ }) {
+                readRaw(in, ids.data(), n);
+                for (NodeId id = 0; id < n; ++id) {
+                    if (ids[id] != noNode && ids[id] >= n)
+                        throw std::runtime_error("Checkpoint is corrupt");
+                    nodes_[id].*field = ids[id];
+                }
+            }
+
+            uint64_t components;
+            readRaw(in, &components, 1);
+            readRaw(in, &firstComp_, 1);
+            readRaw(in, &lastComp_, 1);
+            components_ = components;
+
+            cache_.clear();
+            filter_.clear();
+        }
+
+        /**
+         * Returns the component containing the given isosig, or a
+         * past-the-end component if the isosig is not in the set.
+         *
+         * Any number of threads may call this at once, as long as nobody
+         * is modifying the set.
+         */
+        Component find(std::string_view sig) const {
+            std::string key;
+            if (! PackedSig::pack(sig, key))
+                return Component(this, noNode);
+            return Component(this, sigs_.find(key));
+        }
+
+        /**
+         * Calls f(sig, c) for every isosig sig in the set, in order of ID,
+         * where c is the component containing it.  Unlike iterating over
+         * the set, this never decodes a triangulation.
+         */
+        template <typename Function>
+        void forEachSig(Function&& f) const {
+            for (NodeId id = 0; id < nodes_.size(); ++id)
+                f(sigs_.text(id), Component(this, id));
+        }
+
+        /**
+         * Computes the fingerprint of every triangulation in the set, so that
+         * fingerprints() can rule out triangulations that are not in the set
+         * without computing their isosigs.  From now on, triangulations
+         * inserted by merge() are fingerprinted as they are added.
+         *
+         * This decodes every isosig in the set, and so is slow for a large
+         * census.  The filter is sized for the given number of entries, and
+         * becomes less selective if the set grows beyond this.
+         */
+        void indexFingerprints(size_t capacity) {
+            filter_.reserve(std::max(capacity, nodes_.size()));
+            for (auto tri : *this)
+                filter_.add(fingerprint(Tri4(tri)));
+        }
+
+        /**
+         * Returns the fingerprint filter for this set.  This contains
+         * everything unless indexFingerprints() has been called.
+         *
+         * The filter may be queried from any thread, even while the set is
+         * being modified.
+         */
+        const FingerprintFilter& fingerprints() const {
+            return filter_;
+        }
+
         /**
          * Returns the number of components in the set.
          */
@@ -453,18 +1269,64 @@ class TriangulationSet {
         }
 
         Component components() const {
-            return firstComp_;
+            return Component(this, firstComp_);
         }
 
         iterator begin() const {
-            return nodes_.begin();
+            return iterator(this, 0);
         }
 
         iterator end() const {
-            return nodes_.end();
+            return iterator(this, nodes_.size());
+        }
+
+        /**
+         * Sets the maximum number of decoded representatives to keep in
+         * memory.  A capacity of zero disables caching entirely.
+         */
+        void setRepCacheSize(size_t capacity) {
+            cache_.setCapacity(capacity);
         }
 
         TriangulationSet(const TriangulationSet&) = delete;
         TriangulationSet& operator = (const TriangulationSet&) = delete;
+
+    friend class Component;
 };
 
+inline void Component::makeRoot() const {
+    while (set_->nodes_[comp_].parent_ != noNode)
+        const_cast<Component*>(this)->comp_ = set_->nodes_[comp_].parent_;
+}
+
+inline size_t Component::size() const {
+    makeRoot();
+    return set_->nodes_[comp_].size_;
+}
+
+inline regina::Triangulation<4> Component::rep() const {
+    return *repHandle();
+}
+
+inline RepCache::Handle Component::repHandle() const {
+    makeRoot();
+    NodeId rep = set_->nodes_[comp_].rep_;
+    return set_->cache_.get(rep, set_->sigs_[rep]);
+}
+
+inline std::string Component::repSig() const {
+    makeRoot();
+    return set_->sigs_.text(set_->nodes_[comp_].rep_);
+}
+
+inline Component& Component::operator ++ () {
+    makeRoot();
+    comp_ = set_->nodes_[comp_].nextComp_;
+    return *this;
+}
+
+inline Component& Component::operator -- () {
+    makeRoot();
+    comp_ = set_->nodes_[comp_].prevComp_;
+    return *this;
+}
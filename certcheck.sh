@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Records certificates for a small census with walks that give up after a
+# single attempt (-rfixed:BUDGET:0), and checks that verify accepts them.
+# Run from the top of this repository after `make main verify`:
+#
+#	./certcheck.sh [ CENSUS_FILE [ BUDGET ] ]
+#
+# The census file should contain a single PL class (by default the
+# 2-pentachoron 4-sphere), so that verify can report CLASSIFICATION VERIFIED.
+
+set -e
+
+census=${1:-Census/2p-Sorted/2p-PL-S4.esig}
+budget=${2:-200}
+certificates=$(mktemp)
+trap 'rm -f "$certificates"' EXIT
+
+./main "$census" -i -rfixed:"$budget":0 -s1 --certificates="$certificates" > /dev/null
+./verify "$census" "$certificates"
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "boilerplate.h"
+#include "moveindex.h"
+#include "tri4.h"
+
+/**
+ * The moves made by a sequence of random walks from a single starting
+ * state, as recorded by MoveIndex::log().
+ */
+struct WalkPath {
+    std::vector<uint32_t> moves; // encoded by MoveIndex::encode()
+    std::vector<uint32_t> seenAt; // number of moves made when each state of the last walk's seen list was reached
+};
+
+/**
+ * A certificate that two triangulations are connected by moves: replaying
+ * the moves on the triangulation with isosig start yields a triangulation
+ * with isosig end.
+ */
+struct Certificate {
+    std::string start;
+    std::string end;
+    std::vector<uint32_t> moves; // encoded by MoveIndex::encode()
+};
+
+/**
+ * Certificate files consist of a header (a magic number and a version,
+ * each a 32-bit integer) followed by any number of records, each of the
+ * form
+ *
+ *     length of start (uint32), start, length of end (uint32), end,
+ *     number of moves (uint32), moves (uint32 each),
+ *
+ * all in native byte order.  Records are only ever appended, so a run can
+ * carry on with the file of an earlier run.
+ */
+constexpr uint32_t certificateMagic = 0x43433444; // "D4CC"
+constexpr uint32_t certificateVersion = 1;
+
+/**
+ * Appends certificates to a certificate file.
+ *
+ * Only merges made by random walks and beam searches are recorded.  Merges
+ * found by the exhaustive search (-b) or the collision search (-c) are not,
+ * and neither are the connections within the known classes loaded by
+ * --classes, which are taken as given.
+ */
+// Heavyweight class, do not copy!
+class CertificateWriter {
+    private:
+        std::string file_;
+        std::ofstream out_;
+        size_t count_ { 0 };
+
+    public:
+        /**
+         * Opens the given certificate file.  If append is true and the
+         * file already exists then new certificates are added to the end;
+         * otherwise the file is started afresh.
+         *
+         * Throws std::runtime_error if the file cannot be written.
+         */
+        CertificateWriter(const std::string& file, bool append) :
+                file_(file) {
+            bool exists = append && std::ifstream(file).good();
+            out_.open(file, std::ios::binary |
+                (exists ? std::ios::app : std::ios::trunc));
+            if (! out_)
+                throw std::runtime_error("Cannot write certificates to " + file);
+            if (! exists) {
+                uint32_t header[2] = { certificateMagic, certificateVersion };
+                writeRaw(out_, header, 2);
+                check();
+            }
+        }
+
+        /**
+         * Records that the first nMoves of the given moves lead from start
+         * to end.
+         *
+         * Throws std::runtime_error if the file cannot be written.
+         */
+        void add(const std::string& start, const std::string& end,
+                const uint32_t* moves, uint32_t nMoves) {
+            uint32_t len = start.size();
+            writeRaw(out_, &len, 1);
+            writeRaw(out_, start.data(), len);
+            len = end.size();
+            writeRaw(out_, &len, 1);
+            writeRaw(out_, end.data(), len);
+            writeRaw(out_, &nMoves, 1);
+            writeRaw(out_, moves, nMoves);
+            check();
+            ++count_;
+        }
+
+        /**
+         * Writes out everything added so far.
+         *
+         * Throws std::runtime_error if the file cannot be written.
+         */
+        void flush() {
+            out_.flush();
+            check();
+        }
+
+        /**
+         * Returns the number of certificates added by this writer.
+         */
+        size_t count() const {
+            return count_;
+        }
+
+        CertificateWriter(const CertificateWriter&) = delete;
+        CertificateWriter& operator = (const CertificateWriter&) = delete;
+
+    private:
+        void check() const {
+            if (! out_)
+                throw std::runtime_error("Cannot write certificates to " + file_);
+        }
+};
+
+/**
+ * Reads every certificate from the given certificate file, appending them
+ * to ans.  Throws std::runtime_error if the file cannot be read or is not
+ * a certificate file.
+ */
+inline void readCertificates(const std::string& file,
+        std::vector<Certificate>& ans) {
+    std::ifstream in(file, std::ios::binary);
+    if (! in)
+        throw std::runtime_error("Cannot open certificates " + file);
+    uint32_t header[2];
+    if (! in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+            header[0] != certificateMagic || header[1] != certificateVersion)
+        throw std::runtime_error(file + " is not a certificate file of this version");
+
+    auto read = [&](void* data, size_t bytes) {
+        in.read(static_cast<char*>(data), bytes);
+        if (! in)
+            throw std::runtime_error(file + " is truncated");
+    };
+    uint32_t len;
+    while (in.read(reinterpret_cast<char*>(&len), sizeof(len))) {
+        Certificate c;
+        c.start.resize(len);
+        read(c.start.data(), len);
+        read(&len, sizeof(len));
+        c.end.resize(len);
+        read(c.end.data(), len);
+        read(&len, sizeof(len));
+        c.moves.resize(len);
+        read(c.moves.data(), len * sizeof(uint32_t));
+        ans.push_back(std::move(c));
+    }
+}
+
+/**
+ * Replays the given certificate, and returns true if every move is legal
+ * and the moves lead to the claimed end.
+ */
+inline bool verifyCertificate(const Certificate& cert) {
+    // number of vertices of the face about which each move is made
+    static constexpr int faceVertices[MoveIndex::nMoves] = { 2, 3, 2, 3, 4, 5 };
+    try {
+        Tri4 tri(regina::Triangulation<4>::fromIsoSig(cert.start));
+        if (tri.size() == 0)
+            return false;
+        MoveIndex index;
+        MoveIndex::Move m;
+        MoveIndex::Candidate c;
+        for (uint32_t code : cert.moves) {
+            MoveIndex::decode(code, m, c);
+            if (m >= MoveIndex::nMoves || size_t(c.pent) >= tri.size() ||
+                    __builtin_popcount(c.mask) != faceVertices[m])
+                return false;
+            if (! index.apply(tri, m, c))
+                return false;
+        }
+        return tri.isoSig() == cert.end;
+    } catch (const std::exception&) {
+        // not an isosig
+        return false;
+    }
+}
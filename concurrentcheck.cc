@@ -0,0 +1,203 @@
+#include "boilerplate.h"
+#include "concurrentset.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+/*
+Checks ConcurrentTriangulationSet against TriangulationSet on whole census
+files.
+
+Each file is loaded into both sets, and a few triangulations are chosen as
+hubs.  Every other triangulation is assigned to a hub, and is merged into its
+hub's component, with the hub's representative kept (half of the merges name
+the hub first and half name it second).  Some merges bring in new isosigs
+that are not in the census.  TriangulationSet makes these merges in order on
+a single thread, and ConcurrentTriangulationSet makes them from many threads
+at once, each taking its own share in a random order.  Meanwhile another
+thread keeps taking snapshots of the components, and checks that every hub
+is always its own component's representative (a merge must never show a
+representative that is not yet linked in), and that every snapshot counts
+all nodes that were there when it began.
+
+Afterwards both sets must have the same size and the same number of
+components, the same isosigs must be together in each component, and each
+component must have the same representative.
+
+The program exits with status 0 only if no difference is found.
+*/
+
+/*
+# check: runs the check above on one census file
+#
+# threads:	number of merging threads
+# seed:		random seed for the choice of hubs and the order of merges
+*/
+bool check(const char* file, unsigned threads, unsigned seed) {
+    TriangulationSet serial(file);
+    ConcurrentTriangulationSet concurrent(file);
+    if (serial.size() != concurrent.size()) {
+        std::cerr << file << ": the sets differ in size after loading." << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> sigs;
+    serial.forEachSig([&](std::string_view sig, Component) {
+        sigs.emplace_back(sig);
+    });
+
+    // hubs, and the merges into them: {hub, other, hub named first}
+    struct Merge {
+        size_t hub;
+        std::string sig;
+        bool hubFirst;
+    };
+    std::mt19937 rng(seed);
+    size_t hubs = std::max<size_t>(1, sigs.size() / 1000);
+    std::vector<Merge> merges;
+    for (size_t i = hubs; i < sigs.size(); ++i)
+        if (rng() % 4 != 0)
+            merges.push_back({ rng() % hubs, sigs[i], rng() % 2 == 0 });
+    for (size_t i = 0; i < sigs.size() / 4; ++i)
+        merges.push_back({ rng() % hubs, "zz" + std::to_string(i), rng() % 2 == 0 });
+    std::shuffle(merges.begin(), merges.end(), rng);
+
+    for (const Merge& m : merges) {
+        Component hub = serial.find(sigs[m.hub]);
+        if (m.hubFirst)
+            serial.mergeSig(hub, m.sig, true);
+        else {
+            Component other = serial.find(m.sig);
+            if (other)
+                serial.merge(other, hub, false);
+            else
+                serial.mergeSig(hub, m.sig, true);
+        }
+    }
+
+    std::vector<ConcurrentTriangulationSet::Id> hubIds(hubs);
+    for (size_t i = 0; i < hubs; ++i)
+        concurrent.find(sigs[i], hubIds[i]);
+
+    std::atomic<bool> done { false };
+    std::atomic<size_t> problems { 0 };
+    std::thread watcher([&]() {
+        while (! done.load()) {
+            for (auto h : hubIds)
+                if (concurrent.repId(h) != h)
+                    ++problems;
+            size_t before = concurrent.size(), total = 0;
+            for (const auto& c : concurrent.components())
+                total += c.size;
+            if (total < before)
+                ++problems;
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]() {
+            std::vector<size_t> mine;
+            for (size_t i = t; i < merges.size(); i += threads)
+                mine.push_back(i);
+            std::shuffle(mine.begin(), mine.end(), std::mt19937(seed + t + 1));
+            for (size_t i : mine) {
+                const Merge& m = merges[i];
+                auto other = concurrent.node(m.sig);
+                if (m.hubFirst)
+                    concurrent.merge(hubIds[m.hub], other, true);
+                else
+                    concurrent.merge(other, hubIds[m.hub], false);
+            }
+        });
+    for (auto& w : workers)
+        w.join();
+    done = true;
+    watcher.join();
+
+    const char* problem = nullptr;
+    if (problems)
+        problem = "a snapshot or representative was wrong during the merges";
+    else if (serial.size() != concurrent.size())
+        problem = "the sets differ in size";
+    else if (serial.countComponents() != concurrent.countComponents() ||
+            serial.countComponents() != concurrent.components().size())
+        problem = "the numbers of components differ";
+    else {
+        // Matching roots must pair off one to one.
+        std::unordered_map<NodeId, ConcurrentTriangulationSet::Id> toConcurrent;
+        std::unordered_map<ConcurrentTriangulationSet::Id, NodeId> toSerial;
+        serial.forEachSig([&](std::string_view sig, Component c) {
+            ConcurrentTriangulationSet::Id id;
+            if (problem)
+                return;
+            if (! concurrent.find(std::string(sig), id)) {
+                problem = "an isosig is missing";
+                return;
+            }
+            NodeId r = c.root();
+            ConcurrentTriangulationSet::Id cr = concurrent.root(id);
+            auto a = toConcurrent.emplace(r, cr).first;
+            auto b = toSerial.emplace(cr, r).first;
+            if (a->second != cr || b->second != r)
+                problem = "the components differ";
+            else if (c.repSig() != concurrent.repSig(id))
+                problem = "the representatives differ";
+        });
+    }
+
+    if (problem)
+        std::cerr << file << ": " << problem << "." << std::endl;
+    std::cout << file << ": " << merges.size() << " merges on " << threads <<
+        " threads, " << concurrent.countComponents() << " components." << std::endl;
+    return ! problem;
+}
+
+void usage(const char* progName, const std::string& error = std::string()) {
+    if (!error.empty()) {
+        std::cerr << error << "\n\n";
+    }
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "      " << progName << " [ -j=threads ] [ -s=seed ] [ census files ... ]\n";
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned threads = 8;
+    unsigned seed = 1;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-')
+            files.push_back(argv[i]);
+        else if (argv[i][1] == 'j')
+            threads = std::stoul(argv[i] + 2);
+        else if (argv[i][1] == 's')
+            seed = std::stoul(argv[i] + 2);
+        else
+            usage(argv[0], std::string("Invalid Option: ") + argv[i]);
+    }
+    if (threads == 0)
+        usage(argv[0], "Error: Need at least one thread");
+    if (files.empty())
+        files = { "Census/2p-closedOrientable.esig",
+            "Census/4p-closedOrientable.esig" };
+
+    size_t failed = 0;
+    for (const char* file : files) {
+        try {
+            if (! check(file, threads, seed))
+                ++failed;
+        } catch (const std::exception& e) {
+            usage(argv[0], e.what());
+        }
+    }
+
+    if (failed == 0) {
+        std::cout << "CONCURRENT SET AGREES WITH TRIANGULATIONSET." << std::endl;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "packedsig.h"
+
+/**
+ * A map from isosigs to values that many threads can use at once.
+ *
+ * The map is split into shards, each with its own lock, so that threads
+ * only contend when they touch the same shard.  Entries are never removed,
+ * and the addresses of keys never change once inserted.
+ *
+ * Keys are printable isosigs by default; ConcurrentTriangulationSet keys
+ * its map by PackedSig instead.
+ */
+template <typename T, typename Key = std::string,
+    typename Hash = std::hash<Key>>
+class ConcurrentSigMap {
+    private:
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::unordered_map<Key, T, Hash> map;
+        };
+
+        std::unique_ptr<Shard[]> shards_;
+        size_t mask_;
+
+    public:
+        /**
+         * Creates an empty map.  The number of shards is rounded up to a
+         * power of two.
+         */
+        explicit ConcurrentSigMap(size_t nShards = 256) {
+            size_t n = 1;
+            while (n < nShards)
+                n <<= 1;
+            shards_.reset(new Shard[n]);
+            mask_ = n - 1;
+        }
+
+        /**
+         * Inserts the given value under the given isosig, unless the isosig
+         * is already present.
+         *
+         * Returns the value now stored under the isosig (which is the
+         * existing value if there was one), and true if and only if this
+         * call inserted it.
+         *
+         * The callback make(const Key& key) is called to produce the
+         * value, while the shard is locked, only if an insertion takes place.
+         * Its argument is the key as stored in the map.
+         */
+        template <typename Make>
+        std::pair<T, bool> insert(const Key& sig, Make&& make) {
+            Shard& s = shard(sig);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto pos = s.map.find(sig);
+            if (pos != s.map.end())
+                return { pos->second, false };
+            pos = s.map.emplace(sig, T()).first;
+            pos->second = make(pos->first);
+            return { pos->second, true };
+        }
+
+        /**
+         * Looks up the given isosig.  Returns true and sets value if the
+         * isosig is present, or returns false if it is not.
+         */
+        bool find(const Key& sig, T& value) const {
+            Shard& s = shard(sig);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto pos = s.map.find(sig);
+            if (pos == s.map.end())
+                return false;
+            value = pos->second;
+            return true;
+        }
+
+        /**
+         * Returns the number of isosigs in the map.  If other threads are
+         * inserting at the same time then this is only a lower bound.
+         */
+        size_t size() const {
+            size_t ans = 0;
+            for (size_t i = 0; i <= mask_; ++i) {
+                std::lock_guard<std::mutex> lock(shards_[i].mutex);
+                ans += shards_[i].map.size();
+            }
+            return ans;
+        }
+
+        ConcurrentSigMap(const ConcurrentSigMap&) = delete;
+        ConcurrentSigMap& operator = (const ConcurrentSigMap&) = delete;
+
+    private:
+        Shard& shard(const Key& sig) const {
+            return shards_[Hash()(sig) & mask_];
+        }
+};
+
+/**
+ * A variant of TriangulationSet that any number of threads may query and
+ * merge into at the same time, without a global lock.
+ *
+ * Nodes are referred to by integer IDs, which are handed out in order of
+ * insertion.  The union-find forest uses atomic parent links: roots are
+ * joined with a single compare-and-swap, and root() compresses paths by
+ * halving as it goes.  Roots are linked according to a fixed pseudo-random
+ * priority per node, which keeps trees shallow without having to maintain
+ * ranks atomically.  Isosigs are stored as packed keys, as in
+ * TriangulationSet, in a sharded map; only insertions lock a shard, and
+ * merge(), same() and countComponents() never take a lock.
+ *
+ * Instead of a linked list of components, iteration takes a snapshot of the
+ * current roots; see components().
+ */
+// Heavyweight class, do not copy!
+class ConcurrentTriangulationSet {
+    public:
+        using Id = uint32_t;
+
+        /**
+         * A snapshot of a single component, as returned by components().
+         */
+        struct ComponentInfo {
+            Id root; // root node at the time of the snapshot
+            Id rep; // preferred representative at the time of the snapshot
+            size_t size; // number of triangulations at the time of the snapshot
+        };
+
+    private:
+        struct Slot {
+            std::atomic<Id> parent; // equal to the node's own ID for a root
+            // Preferred representative in the low 32 bits, meaningful for
+            // roots only, and a count of changes in the high 32 bits:
+            std::atomic<uint64_t> rep;
+            std::atomic<bool> ready { false }; // set once the slot is filled in
+            const PackedSig* sig { nullptr }; // key as stored in sigs_
+        };
+
+        static constexpr int chunkBits = 16;
+        static constexpr size_t chunkSize = size_t(1) << chunkBits;
+        static constexpr size_t maxChunks = size_t(1) << 16;
+
+        ConcurrentSigMap<Id, PackedSig, PackedSigHash> sigs_;
+        std::unique_ptr<std::atomic<Slot*>[]> chunks_;
+        std::mutex chunkMutex_;
+        std::atomic<Id> next_ { 0 }; // IDs handed out, ready or not
+        std::atomic<size_t> size_ { 0 }; // nodes whose slots are ready
+        std::atomic<size_t> components_ { 0 };
+
+    public:
+        ConcurrentTriangulationSet() : chunks_(new std::atomic<Slot*>[maxChunks]) {
+            for (size_t i = 0; i < maxChunks; ++i)
+                chunks_[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        /**
+         * Reads in a triangulation set from the given file, which should be
+         * in the same format as for the TriangulationSet constructor.
+         *
+         * Each triangulation will become an isolated component.  Throws
+         * std::runtime_error if the file cannot be read, and
+         * std::invalid_argument if it contains characters that cannot
+         * appear in an isosig.
+         */
+        ConcurrentTriangulationSet(const char* filename) :
+                ConcurrentTriangulationSet() {
+            std::ifstream f(filename);
+            if (! f)
+                throw std::runtime_error(std::string("Cannot read ") +
+                    filename + ": " + std::strerror(errno));
+
+            while (true) {
+                std::string sig;
+                f >> sig;
+                if (! f)
+                    break;
+                if (sig.size() > 0)
+                    node(sig);
+            }
+        }
+
+        ~ConcurrentTriangulationSet() {
+            for (size_t i = 0; i < maxChunks; ++i)
+                delete[] chunks_[i].load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the ID of the node for the given packed isosig.  If the
+         * isosig is not already in the set, it will be inserted as a new
+         * isolated component.
+         */
+        Id node(const PackedSig& sig) {
+            return sigs_.insert(sig, [this](const PackedSig& key) {
+                // The slot is allocated and filled in before the node is
+                // counted, so nobody who sees the node in size() or through
+                // sigs_ can find its chunk missing.
+                Id id = next_.fetch_add(1);
+                Slot& s = slot(id, true);
+                s.parent.store(id, std::memory_order_relaxed);
+                s.rep.store(uint64_t(id), std::memory_order_relaxed);
+                s.sig = &key;
+                s.ready.store(true, std::memory_order_release);
+                size_.fetch_add(1, std::memory_order_release);
+                components_.fetch_add(1);
+                return id;
+            }).first;
+        }
+
+        /**
+         * Returns the ID of the node for the given printable isosig,
+         * inserting it as a new isolated component if necessary.  Throws
+         * std::invalid_argument if it contains characters that cannot
+         * appear in an isosig.
+         */
+        Id node(const std::string& sig) {
+            return node(PackedSig(sig));
+        }
+
+        /**
+         * Returns the ID of the node for the given triangulation, inserting
+         * it as a new isolated component if necessary.
+         */
+        Id node(const regina::Triangulation<4>& tri) {
+            return node(tri.isoSig<regina::IsoSigEdgeDegrees<4>,
+                PackedSigEncoding<4>>());
+        }
+
+        /**
+         * Looks up the given isosig without inserting it.  Returns true and
+         * sets id if the isosig is present, or returns false otherwise.
+         */
+        bool find(const PackedSig& sig, Id& id) const {
+            return sigs_.find(sig, id);
+        }
+
+        /**
+         * A variant of find() that takes a printable isosig.  Text with
+         * characters that cannot appear in an isosig is never present.
+         */
+        bool find(const std::string& sig, Id& id) const {
+            for (char c : sig)
+                if (packedSigTables.code[uint8_t(c)] == 64)
+                    return false;
+            return find(PackedSig(sig), id);
+        }
+
+        /**
+         * Returns the root of the tree containing the given node, halving
+         * the path to the root along the way.
+         *
+         * Under concurrent merges, the answer was the root at some moment
+         * during the call.
+         */
+        Id root(Id id) const {
+            while (true) {
+                Slot& s = slot(id);
+                Id p = s.parent.load(std::memory_order_acquire);
+                if (p == id)
+                    return id;
+                Id gp = slot(p).parent.load(std::memory_order_acquire);
+                if (gp == p)
+                    return p;
+                // Point id at its grandparent.  If this fails then somebody
+                // else has already compressed the path, which is fine.
+                s.parent.compare_exchange_weak(p, gp, std::memory_order_acq_rel);
+                id = gp;
+            }
+        }
+
+        /**
+         * Determines whether the two given nodes are in the same component.
+         */
+        bool same(Id a, Id b) const {
+            while (true) {
+                a = root(a);
+                b = root(b);
+                if (a == b)
+                    return true;
+                // a might have stopped being a root while we looked up b.
+                if (slot(a).parent.load(std::memory_order_acquire) == a)
+                    return false;
+            }
+        }
+
+        /**
+         * Merge the components containing the two given nodes.
+         * These do not need to be root nodes.
+         *
+         * Returns true if two distinct components were merged by this call,
+         * or false if both nodes already belonged to the same component.
+         *
+         * The merged component will use the preferred representative from
+         * n1 if useRep1 is true, or from n2 if useRep1 is false.  If other
+         * threads are merging into the same component at the same time then
+         * one of them decides the representative.
+         */
+        bool merge(Id n1, Id n2, bool useRep1 = true) {
+            while (true) {
+                n1 = root(n1);
+                n2 = root(n2);
+                if (n1 == n2)
+                    return false;
+
+                // Never pass on a representative that another merge has
+                // published but not yet linked in.
+                Id rep = repId(useRep1 ? n1 : n2);
+
+                // Link the root of lower priority beneath the other.
+                Id child = n1, parent = n2;
+                if (priority(n1) > priority(n2))
+                    std::swap(child, parent);
+
+                // Publish the representative on the surviving root before
+                // the link, so that whoever finds the merged root also
+                // finds its representative.  Until the link is made, the
+                // representative is not yet in the component, and repId()
+                // waits for it.  Only one such unlinked representative may
+                // be published on a root at a time.
+                Slot& p = slot(parent);
+                uint64_t old = p.rep.load(std::memory_order_acquire);
+                if (! same(Id(old), parent))
+                    continue;
+                uint64_t mine = old;
+                if (Id(old) != rep) {
+                    mine = (((old >> 32) + 1) << 32) | rep;
+                    if (! p.rep.compare_exchange_strong(old, mine,
+                            std::memory_order_acq_rel))
+                        continue;
+                }
+
+                Id expected = child;
+                if (slot(child).parent.compare_exchange_strong(expected, parent,
+                        std::memory_order_acq_rel)) {
+                    components_.fetch_sub(1);
+                    return true;
+                }
+
+                // Somebody linked child elsewhere first.  Withdraw our
+                // representative, unless somebody has replaced it already
+                // (the change count tells ours apart from an equal one), and
+                // try again.
+                if (mine != old)
+                    p.rep.compare_exchange_strong(mine, old,
+                        std::memory_order_acq_rel);
+            }
+        }
+
+        /**
+         * Merge the components containing the two given triangulations,
+         * inserting them first if necessary.
+         */
+        bool merge(const regina::Triangulation<4>& t1,
+                const regina::Triangulation<4>& t2,
+                bool useRep1 = true) {
+            return merge(node(t1), node(t2), useRep1);
+        }
+
+        /**
+         * A variant of merge() that takes a node in the component containing
+         * the first triangulation, instead of the triangulation itself.
+         */
+        bool merge(Id c, const regina::Triangulation<4>& t2,
+                bool useRep1 = true) {
+            return merge(c, node(t2), useRep1);
+        }
+
+        /**
+         * Returns the number of components in the set.
+         */
+        size_t countComponents() const {
+            return components_.load();
+        }
+
+        /**
+         * Returns the number of isosigs in the set.
+         */
+        size_t size() const {
+            return size_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Returns the printable isosig for the given node.
+         */
+        std::string sig(Id id) const {
+            return slot(id).sig->text();
+        }
+
+        /**
+         * Returns the node of the preferred representative for the
+         * component containing the given node.
+         */
+        Id repId(Id id) const {
+            while (true) {
+                Id r = root(id);
+                Id ans = Id(slot(r).rep.load(std::memory_order_acquire));
+                // A merge into r may have published its representative
+                // without having linked it in yet.
+                if (same(ans, r))
+                    return ans;
+            }
+        }
+
+        /**
+         * Returns the isosig of the preferred representative for the
+         * component containing the given node, without decoding it.
+         */
+        std::string repSig(Id id) const {
+            return sig(repId(id));
+        }
+
+        /**
+         * Returns the preferred representative for the component containing
+         * the given node.
+         */
+        regina::Triangulation<4> rep(Id id) const {
+            return regina::Triangulation<4>::fromIsoSig(repSig(id));
+        }
+
+        /**
+         * Returns a snapshot of all components, in order of their roots.
+         *
+         * If other threads are merging at the same time then the snapshot
+         * may mix states from before and after their merges, but every node
+         * that was present when the call began will be counted exactly once.
+         */
+        std::vector<ComponentInfo> components() const {
+            Id n = next_.load(std::memory_order_acquire);
+            const Id none = Id(-1);
+            std::vector<Id> roots(n, none);
+            Id bound = n; // roots may be nodes inserted after the call began
+            for (Id i = 0; i < n; ++i) {
+                // Skip IDs whose inserting thread has not filled them in yet.
+                if (ready(i)) {
+                    roots[i] = root(i);
+                    if (roots[i] >= bound)
+                        bound = roots[i] + 1;
+                }
+            }
+
+            std::vector<size_t> sizes(bound, 0);
+            for (Id i = 0; i < n; ++i)
+                if (roots[i] != none)
+                    ++sizes[roots[i]];
+
+            std::vector<ComponentInfo> ans;
+            for (Id i = 0; i < bound; ++i)
+                if (sizes[i])
+                    ans.push_back({ i, repId(i), sizes[i] });
+            return ans;
+        }
+
+        ConcurrentTriangulationSet(const ConcurrentTriangulationSet&) = delete;
+        ConcurrentTriangulationSet& operator = (const ConcurrentTriangulationSet&) = delete;
+
+    private:
+        /**
+         * Returns the slot for the given node, allocating its chunk if
+         * requested.
+         *
+         * PRE: Unless create is true, the node's slot is ready.
+         */
+        Slot& slot(Id id, bool create = false) const {
+            size_t c = id >> chunkBits;
+            Slot* chunk = chunks_[c].load(std::memory_order_acquire);
+            if (! chunk && create) {
+                auto* self = const_cast<ConcurrentTriangulationSet*>(this);
+                std::lock_guard<std::mutex> lock(self->chunkMutex_);
+                chunk = chunks_[c].load(std::memory_order_acquire);
+                if (! chunk) {
+                    chunk = new Slot[chunkSize];
+                    chunks_[c].store(chunk, std::memory_order_release);
+                }
+            }
+            return chunk[id & (chunkSize - 1)];
+        }
+
+        /**
+         * Determines whether the given ID has been handed out and its slot
+         * filled in.  Unlike slot(), this is safe for any ID.
+         */
+        bool ready(Id id) const {
+            Slot* chunk = chunks_[id >> chunkBits].load(
+                std::memory_order_acquire);
+            return chunk &&
+                chunk[id & (chunkSize - 1)].ready.load(std::memory_order_acquire);
+        }
+
+        /**
+         * A fixed pseudo-random priority for each node (splitmix64).
+         */
+        static uint64_t priority(Id id) {
+            uint64_t z = id + 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+};
@@ -0,0 +1,736 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "packedsig.h"
+
+/**
+ * A growable array of plain objects in a memory mapping of its own: either
+ * anonymous memory, or a file that the kernel pages in and out as needed.
+ * Growing the array remaps it instead of copying it.
+ */
+// Heavyweight class, do not copy!
+template <typename T>
+class MappedArray {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    private:
+        int fd_ { -1 }; // backing file, or -1 for anonymous memory
+        T* data_ { nullptr };
+        size_t size_ { 0 };
+        size_t bytes_ { 0 }; // size of the mapping
+
+    public:
+        /**
+         * Creates an empty array in anonymous memory.
+         */
+        MappedArray() = default;
+
+        ~MappedArray() {
+            release();
+        }
+
+        /**
+         * Empties the array and backs it by the given file from now on.  The
+         * file is created, or truncated if it already exists.
+         *
+         * Throws std::runtime_error if the file cannot be created.
+         */
+        void open(const std::string& file) {
+            release();
+            fd_ = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0)
+                throw std::runtime_error("Cannot create " + file + ": " +
+                    std::strerror(errno));
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        T* data() {
+            return data_;
+        }
+
+        const T* data() const {
+            return data_;
+        }
+
+        T& operator [] (size_t i) {
+            return data_[i];
+        }
+
+        const T& operator [] (size_t i) const {
+            return data_[i];
+        }
+
+        /**
+         * Makes room for n elements.  This invalidates pointers into the
+         * array, unless there was room already.
+         */
+        void reserve(size_t n) {
+            if (n * sizeof(T) <= bytes_)
+                return;
+            size_t page = ::sysconf(_SC_PAGESIZE);
+            size_t want = std::max(n * sizeof(T), 2 * bytes_);
+            want = (want + page - 1) / page * page;
+            if (fd_ >= 0 && ::ftruncate(fd_, want) != 0)
+                throw std::runtime_error(std::string("Cannot grow file: ") +
+                    std::strerror(errno));
+            void* p = (data_ ?
+                ::mremap(data_, bytes_, want, MREMAP_MAYMOVE) :
+                ::mmap(nullptr, want, PROT_READ | PROT_WRITE,
+                    fd_ >= 0 ? MAP_SHARED : (MAP_PRIVATE | MAP_ANONYMOUS),
+                    fd_, 0));
+            if (p == MAP_FAILED)
+                throw std::runtime_error(std::string("Cannot map memory: ") +
+                    std::strerror(errno));
+            data_ = static_cast<T*>(p);
+            bytes_ = want;
+            // Lookups land all over the file, so reading ahead (or mapping
+            // the pages around each fault) would only swell the resident set.
+            if (fd_ >= 0)
+                ::madvise(data_, bytes_, MADV_RANDOM);
+        }
+
+        /**
+         * Sets the number of elements.  New elements are left as they are
+         * in memory, which is zeroes unless the array has been cleared.
+         */
+        void resize(size_t n) {
+            reserve(n);
+            size_ = n;
+        }
+
+        void assign(size_t n, const T& value) {
+            resize(n);
+            std::fill(data_, data_ + n, value);
+        }
+
+        void push_back(const T& value) {
+            if ((size_ + 1) * sizeof(T) > bytes_)
+                reserve(size_ + 1);
+            data_[size_++] = value;
+        }
+
+        template <typename... Args>
+        void emplace_back(Args&&... args) {
+            push_back(T(std::forward<Args>(args)...));
+        }
+
+        void append(const T* values, size_t n) {
+            reserve(size_ + n);
+            std::memcpy(data_ + size_, values, n * sizeof(T));
+            size_ += n;
+        }
+
+        void clear() {
+            size_ = 0;
+        }
+
+        /**
+         * If the array is backed by a file, takes its pages out of the
+         * resident set of this process; they are read back from the file
+         * (or the page cache) when next touched.  Does nothing for
+         * anonymous memory, whose pages would be lost.
+         */
+        void drop() const {
+            if (fd_ >= 0 && data_)
+                ::madvise(data_, bytes_, MADV_DONTNEED);
+        }
+
+        void swap(MappedArray& other) noexcept {
+            std::swap(fd_, other.fd_);
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            std::swap(bytes_, other.bytes_);
+        }
+
+        MappedArray(const MappedArray&) = delete;
+        MappedArray& operator = (const MappedArray&) = delete;
+
+    private:
+        void release() {
+            if (data_)
+                ::munmap(data_, bytes_);
+            if (fd_ >= 0) {
+                if (::ftruncate(fd_, size_ * sizeof(T)) != 0) {
+                    // The file is scratch space, so leaving it longer than
+                    // it needs to be does no harm.
+                }
+                ::close(fd_);
+            }
+            fd_ = -1;
+            data_ = nullptr;
+            size_ = bytes_ = 0;
+        }
+};
+
+/**
+ * Returns the number of bytes in the resident set of this process.
+ */
+inline size_t residentBytes() {
+    // This is called often, so keep the file open and read it afresh.
+    static int fd = ::open("/proc/self/statm", O_RDONLY);
+    char buf[128];
+    ssize_t len = (fd >= 0 ? ::pread(fd, buf, sizeof(buf) - 1, 0) : -1);
+    if (len <= 0)
+        return 0;
+    buf[len] = 0;
+    unsigned long total = 0, resident = 0;
+    std::sscanf(buf, "%lu %lu", &total, &resident);
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Interned keys (see PackedSig) kept on disk, for censuses that do not fit
+ * in memory.  SigStore uses this in place of its arena and hash table once
+ * SigStore::storeOnDisk() has been called.
+ *
+ * Three files in a directory of the caller's choosing hold the keys:
+ *
+ * - keys: every key, back to back, in order of ID;
+ *
+ * - offsets: where each key starts in keys, as for SigStore;
+ *
+ * - sorted: a fixed-size record for each key, holding its length, the key
+ *   padded with zeroes to the longest key, and its ID, with records ordered
+ *   by length and then by key.
+ *
+ * The start of the first record in every page of sorted is copied into
+ * memory, so that looking up a key touches only the one or two pages of
+ * sorted that could hold it.  Keys inserted since sorted was last written
+ * are held in a write buffer in memory as well, which is merged into
+ * sorted (rewriting it from start to end) once it outgrows its share of
+ * the memory budget.
+ *
+ * The files are scratch space, rewritten from scratch by every run.
+ */
+// Heavyweight class, do not copy!
+class DiskSigIndex {
+    public:
+        static constexpr size_t maxKeyBytes = 255; // length must fit in a byte
+        static constexpr uint32_t noId = uint32_t(-1);
+
+    private:
+        struct Hash {
+            size_t operator () (std::string_view key) const {
+                return PackedSig::hash(key);
+            }
+        };
+
+        std::string dir_;
+        size_t budget_; // bytes of memory for sorting and buffering
+        MappedArray<char> keys_; // all keys, back to back
+        MappedArray<uint64_t> offsets_; // key i is [offsets_[i], offsets_[i+1])
+        MappedArray<char> sorted_; // records, as described above
+        size_t keyWidth_ { 0 }; // bytes of key in each record
+        size_t perFence_ { 1 }; // records per fence
+        std::string fences_; // length and key of every perFence_-th record
+        std::deque<std::string> bufferKeys_; // keys not yet in sorted_
+        std::unordered_map<std::string_view, uint32_t, Hash> buffer_; // views into bufferKeys_
+        size_t buffered_ { 0 }; // rough memory use of the buffer
+        size_t touched_ { 0 }; // bytes of files touched since the last drop()
+
+    public:
+        /**
+         * Creates an empty index with its files in the given directory,
+         * which must already exist, using about budget bytes of memory at
+         * most for sorting and buffering keys.
+         *
+         * Throws std::runtime_error if the files cannot be created.
+         */
+        DiskSigIndex(const std::string& dir, size_t budget) :
+                dir_(dir), budget_(std::max<size_t>(budget, 1 << 20)) {
+            keys_.open(file("keys"));
+            offsets_.open(file("offsets"));
+            sorted_.open(file("sorted"));
+            offsets_.push_back(0);
+        }
+
+        /**
+         * Returns the number of keys in the index.
+         */
+        size_t size() const {
+            return offsets_.size() - 1;
+        }
+
+        /**
+         * Returns the key with the given ID.  The view is only valid until
+         * the next insertion.
+         */
+        std::string_view operator [] (uint32_t id) const {
+            return std::string_view(keys_.data() + offsets_[id],
+                offsets_[id + 1] - offsets_[id]);
+        }
+
+        /**
+         * Returns the ID of the given key, or noId if it is not present.
+         *
+         * Any number of threads may call this at once, as long as nobody
+         * is inserting keys.
+         */
+        uint32_t find(std::string_view key) const {
+            auto it = buffer_.find(key);
+            if (it != buffer_.end())
+                return it->second;
+            if (key.size() > keyWidth_ || fences_.empty())
+                return noId;
+
+            char probe[1 + maxKeyBytes];
+            prefix(key, probe);
+            size_t w = 1 + keyWidth_;
+
+            // Find the last fence at or before the key ...
+            size_t lo = 0, hi = fences_.size() / w;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (std::memcmp(fences_.data() + mid * w, probe, w) <= 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == 0)
+                return noId;
+
+            // ... and search the records that follow it.
+            lo = (lo - 1) * perFence_;
+            hi = std::min(lo + perFence_, records());
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                const char* r = record(mid);
+                int c = std::memcmp(r, probe, w);
+                if (c == 0) {
+                    uint32_t id;
+                    std::memcpy(&id, r + w, sizeof(id));
+                    return id;
+                }
+                if (c < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return noId;
+        }
+
+        /**
+         * Inserts the given key and returns its new ID.
+         *
+         * PRE: The given key is not already in the index.
+         */
+        uint32_t insert(std::string_view key) {
+            if (key.size() > maxKeyBytes)
+                throw std::runtime_error("Isosig too long for the disk index");
+            uint32_t id = size();
+            keys_.append(key.data(), key.size());
+            offsets_.push_back(keys_.size());
+            touch(key.size() + sizeof(uint64_t));
+
+            bufferKeys_.emplace_back(key);
+            buffer_.emplace(bufferKeys_.back(), id);
+            buffered_ += key.size() + 64;
+            if (buffered_ > budget_ / 8)
+                flush();
+            return id;
+        }
+
+        /**
+         * Fills the index, which must be empty, with the isosigs in the
+         * given text file, skipping repeats.
+         *
+         * The file need not fit in memory: it is read in runs that fit in
+         * the memory budget, each of which is sorted and written to disk,
+         * and the runs are then merged.  Isosigs are therefore numbered in
+         * sorted order of their keys, not in the order of the file.
+         *
+         * Returns the number of isosigs that were skipped as repeats.
+         * Throws std::runtime_error if the file cannot be read, or if it
+         * contains something that is not an isosig.
+         */
+        size_t build(const char* filename) {
+            std::ifstream in(filename);
+            if (! in)
+                throw std::runtime_error(std::string("Cannot read ") +
+                    filename + ": " + std::strerror(errno));
+            std::string sig, key;
+            return sortRuns([&](std::string_view& ans, uint32_t&) {
+                if (! (in >> sig))
+                    return false;
+                key.clear();
+                if (! PackedSig::pack(sig, key))
+                    throw std::runtime_error(std::string(filename) +
+                        " contains something that is not an isosig: " + sig);
+                ans = key;
+                return true;
+            }, true);
+        }
+
+        /**
+         * Writes all keys to the given binary stream, in the same format as
+         * SigStore::save().
+         */
+        void save(std::ostream& out) const {
+            uint64_t n = size(), len = keys_.size();
+            out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            out.write(keys_.data(), len);
+            out.write(reinterpret_cast<const char*>(offsets_.data()),
+                (n + 1) * sizeof(uint64_t));
+            keys_.drop();
+            offsets_.drop();
+        }
+
+        /**
+         * Replaces the contents of the index with keys read from the given
+         * binary stream, as written by save() or SigStore::save().  IDs are
+         * preserved.
+         *
+         * Throws std::runtime_error if the data is truncated or corrupt.
+         */
+        void load(std::istream& in) {
+            auto read = [&](auto* data, size_t n) {
+                in.read(reinterpret_cast<char*>(data), n * sizeof(*data));
+                if (! in)
+                    throw std::runtime_error("Checkpoint is truncated");
+            };
+            uint64_t n, len;
+            read(&n, 1);
+            read(&len, 1);
+            keys_.resize(len);
+            offsets_.resize(n + 1);
+            // Read in pieces, so that pages already read can be let go.
+            constexpr size_t piece = 1 << 24;
+            for (size_t done = 0; done < len; done += piece) {
+                read(keys_.data() + done, std::min(piece, len - done));
+                touch(piece);
+            }
+            for (size_t done = 0; done <= n; done += piece) {
+                read(offsets_.data() + done, std::min<size_t>(piece, n + 1 - done));
+                touch(piece * sizeof(uint64_t));
+            }
+            if (offsets_[0] != 0 || offsets_[n] != len)
+                throw std::runtime_error("Checkpoint is corrupt");
+
+            sorted_.clear();
+            keyWidth_ = 0;
+            fences_.clear();
+            bufferKeys_.clear();
+            buffer_.clear();
+            buffered_ = 0;
+            uint32_t next = 0;
+            sortRuns([&](std::string_view& key, uint32_t& id) {
+                if (next == n)
+                    return false;
+                id = next++;
+                key = (*this)[id];
+                if (key.size() > maxKeyBytes)
+                    throw std::runtime_error("Isosig too long for the disk index");
+                return true;
+            }, false);
+        }
+
+        /**
+         * Takes the pages of all files out of the resident set of this
+         * process.
+         */
+        void drop() {
+            keys_.drop();
+            offsets_.drop();
+            sorted_.drop();
+            touched_ = 0;
+        }
+
+        DiskSigIndex(const DiskSigIndex&) = delete;
+        DiskSigIndex& operator = (const DiskSigIndex&) = delete;
+
+    private:
+        /**
+         * Notes that the given number of bytes of the files have just been
+         * read or written in bulk, and drops all files from the resident
+         * set once this adds up to a quarter of the budget.  Returns true
+         * if the files were dropped.
+         */
+        bool touch(size_t bytes) {
+            touched_ += bytes;
+            if (touched_ < budget_ / 4)
+                return false;
+            drop();
+            return true;
+        }
+
+        std::string file(const char* name) const {
+            return dir_ + "/" + name;
+        }
+
+        /**
+         * Orders keys as the records of sorted are ordered: by length, and
+         * then by bytes.
+         */
+        static bool keyLess(std::string_view a, std::string_view b) {
+            if (a.size() != b.size())
+                return a.size() < b.size();
+            return std::memcmp(a.data(), b.data(), a.size()) < 0;
+        }
+
+        size_t recordBytes() const {
+            return 1 + keyWidth_ + sizeof(uint32_t);
+        }
+
+        size_t records() const {
+            return keyWidth_ ? sorted_.size() / recordBytes() : 0;
+        }
+
+        const char* record(size_t i) const {
+            return sorted_.data() + i * recordBytes();
+        }
+
+        std::string_view recordKey(size_t i) const {
+            const char* r = record(i);
+            return std::string_view(r + 1, uint8_t(r[0]));
+        }
+
+        uint32_t recordId(size_t i) const {
+            uint32_t id;
+            std::memcpy(&id, record(i) + 1 + keyWidth_, sizeof(id));
+            return id;
+        }
+
+        /**
+         * Writes the length and padded key of a record for the given key
+         * to out, which must have room for 1 + keyWidth_ bytes.
+         *
+         * PRE: key.size() <= keyWidth_.
+         */
+        void prefix(std::string_view key, char* out) const {
+            out[0] = char(uint8_t(key.size()));
+            std::memcpy(out + 1, key.data(), key.size());
+            std::memset(out + 1 + key.size(), 0, keyWidth_ - key.size());
+        }
+
+        /**
+         * Starts writing a new sorted file with keys of the given width,
+         * for appendRecord() to fill.
+         */
+        void startSorted(MappedArray<char>& out, size_t keyWidth) {
+            out.open(file("sorted.new"));
+            keyWidth_ = keyWidth;
+            perFence_ = std::max<size_t>(1, ::sysconf(_SC_PAGESIZE) / recordBytes());
+            fences_.clear();
+        }
+
+        void appendRecord(MappedArray<char>& out, std::string_view key,
+                uint32_t id) {
+            char r[1 + maxKeyBytes + sizeof(uint32_t)];
+            prefix(key, r);
+            std::memcpy(r + 1 + keyWidth_, &id, sizeof(id));
+            if ((out.size() / recordBytes()) % perFence_ == 0)
+                fences_.append(r, 1 + keyWidth_);
+            out.append(r, recordBytes());
+            if (touch(recordBytes()))
+                out.drop();
+        }
+
+        /**
+         * Replaces sorted with the file written since startSorted().
+         */
+        void finishSorted(MappedArray<char>& out) {
+            if (std::rename(file("sorted.new").c_str(), file("sorted").c_str()) != 0)
+                throw std::runtime_error("Cannot replace " + file("sorted") +
+                    ": " + std::strerror(errno));
+            sorted_.swap(out);
+        }
+
+        /**
+         * Merges the write buffer into sorted.
+         */
+        void flush() {
+            std::vector<std::pair<std::string_view, uint32_t>> fresh(
+                buffer_.begin(), buffer_.end());
+            std::sort(fresh.begin(), fresh.end(), [](const auto& a, const auto& b) {
+                return keyLess(a.first, b.first);
+            });
+            size_t width = keyWidth_;
+            for (const auto& f : fresh)
+                width = std::max(width, f.first.size());
+
+            size_t old = records();
+            size_t oldWidth = keyWidth_;
+            MappedArray<char> out;
+            startSorted(out, width);
+            size_t i = 0, j = 0;
+            while (i < old || j < fresh.size()) {
+                // Records of the old file, which have the old width:
+                const char* r = nullptr;
+                std::string_view oldKey;
+                if (i < old) {
+                    r = sorted_.data() + i * (1 + oldWidth + sizeof(uint32_t));
+                    oldKey = std::string_view(r + 1, uint8_t(r[0]));
+                }
+                if (j == fresh.size() || (r && keyLess(oldKey, fresh[j].first))) {
+                    uint32_t id;
+                    std::memcpy(&id, r + 1 + oldWidth, sizeof(id));
+                    appendRecord(out, oldKey, id);
+                    touch(recordBytes());
+                    ++i;
+                } else {
+                    appendRecord(out, fresh[j].first, fresh[j].second);
+                    ++j;
+                }
+            }
+            finishSorted(out);
+
+            buffer_.clear();
+            bufferKeys_.clear();
+            buffered_ = 0;
+        }
+
+        /**
+         * Sorts the (key, ID) pairs produced by next() into sorted, and
+         * returns the number of repeated keys, which are left out.
+         *
+         * The function next() should fill in its arguments and return true,
+         * or return false once there are no pairs left.  If assignIds is
+         * true then the IDs that next() gives are ignored, and every key
+         * instead gets the next ID in sorted order, and is added to keys.
+         */
+        size_t sortRuns(const std::function<bool(std::string_view&, uint32_t&)>& next,
+                bool assignIds) {
+            // Sort runs that fit in memory, and write each to its own file
+            // as (length, key, ID) triples.
+            std::vector<std::string> runs;
+            size_t width = 0, repeats = 0;
+            std::string arena;
+            std::vector<std::pair<size_t, uint32_t>> entries; // (end in arena, ID)
+            auto spill = [&]() {
+                std::vector<size_t> order(entries.size());
+                for (size_t i = 0; i < order.size(); ++i)
+                    order[i] = i;
+                auto key = [&](size_t i) {
+                    size_t from = (i ? entries[i - 1].first : 0);
+                    return std::string_view(arena).substr(from,
+                        entries[i].first - from);
+                };
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                    return keyLess(key(a), key(b));
+                });
+                runs.push_back(file(("run" + std::to_string(runs.size())).c_str()));
+                std::ofstream out(runs.back(), std::ios::binary);
+                std::string_view last;
+                for (size_t i = 0; i < order.size(); ++i) {
+                    std::string_view k = key(order[i]);
+                    if (i > 0 && k == last) {
+                        ++repeats;
+                        continue;
+                    }
+                    last = k;
+                    uint8_t len = k.size();
+                    out.put(char(len));
+                    out.write(k.data(), k.size());
+                    out.write(reinterpret_cast<const char*>(&entries[order[i]].second),
+                        sizeof(uint32_t));
+                }
+                if (! out)
+                    throw std::runtime_error("Cannot write " + runs.back());
+                arena.clear();
+                entries.clear();
+            };
+
+            std::string_view key;
+            uint32_t id = 0;
+            while (next(key, id)) {
+                if (key.size() > maxKeyBytes)
+                    throw std::runtime_error("Isosig too long for the disk index");
+                width = std::max(width, key.size());
+                arena.append(key);
+                entries.emplace_back(arena.size(), id);
+                if (arena.size() + entries.size() * 24 > budget_ / 2)
+                    spill();
+            }
+            if (! entries.empty())
+                spill();
+            std::string().swap(arena);
+            std::vector<std::pair<size_t, uint32_t>>().swap(entries);
+
+            // Merge the runs.
+            struct Run {
+                std::ifstream in;
+                std::string key;
+                uint32_t id { 0 };
+
+                bool next() {
+                    int len = in.get();
+                    if (len == EOF)
+                        return false;
+                    key.resize(len);
+                    in.read(key.data(), len);
+                    in.read(reinterpret_cast<char*>(&id), sizeof(id));
+                    return bool(in);
+                }
+            };
+            std::vector<Run> open(runs.size());
+            auto later = [&](size_t a, size_t b) {
+                return keyLess(open[b].key, open[a].key);
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(later)>
+                heap(later);
+            for (size_t i = 0; i < runs.size(); ++i) {
+                open[i].in.open(runs[i], std::ios::binary);
+                if (open[i].next())
+                    heap.push(i);
+            }
+
+            MappedArray<char> out;
+            startSorted(out, width);
+            std::string last;
+            bool first = true;
+            while (! heap.empty()) {
+                size_t i = heap.top();
+                heap.pop();
+                Run& r = open[i];
+                if (! first && r.key == last)
+                    ++repeats;
+                else {
+                    first = false;
+                    last = r.key;
+                    if (assignIds) {
+                        r.id = size();
+                        keys_.append(r.key.data(), r.key.size());
+                        offsets_.push_back(keys_.size());
+                        touch(r.key.size() + sizeof(uint64_t));
+                    }
+                    appendRecord(out, r.key, r.id);
+                }
+                if (r.next())
+                    heap.push(i);
+            }
+            finishSorted(out);
+            for (const std::string& run : runs)
+                std::remove(run.c_str());
+            return repeats;
+        }
+};
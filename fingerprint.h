@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "tri4.h"
+
+/**
+ * Returns a hash of cheap combinatorial invariants of the given
+ * triangulation: its f-vector, its sorted edge and triangle degrees, and
+ * the sorted sizes of its vertex links (in tetrahedra).
+ *
+ * Isomorphic triangulations always have the same fingerprint, so two
+ * triangulations with different fingerprints cannot share an isosig.
+ */
+inline uint64_t fingerprint(const Tri4& tri) {
+    auto mix = [](uint64_t h, uint64_t v) {
+        // splitmix64 finaliser, applied to the running hash
+        h += 0x9e3779b97f4a7c15ull + v;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    };
+
+    uint64_t h = mix(0, tri.size());
+    std::vector<uint32_t> degrees;
+    for (int dim = 0; dim <= 2; ++dim) {
+        size_t n = tri.countFaces(dim);
+        h = mix(h, n);
+        degrees.resize(n);
+        for (size_t f = 0; f < n; ++f)
+            degrees[f] = tri.degree(dim, f);
+        std::sort(degrees.begin(), degrees.end());
+        for (uint32_t d : degrees)
+            h = mix(h, d);
+    }
+    return mix(h, tri.countTetrahedra());
+}
+
+/**
+ * A Bloom filter of fingerprints, used to rule out triangulations that
+ * cannot possibly be in a TriangulationSet before paying for an isosig.
+ *
+ * Any number of threads may call mayContain() while a single thread calls
+ * add(), without further locking.  The filter never reports a false
+ * negative; the false positive rate stays below 1% as long as no more than
+ * the reserved number of fingerprints are added.
+ *
+ * A filter that has never been reserved contains everything.
+ */
+// Heavyweight class, do not copy!
+class FingerprintFilter {
+    private:
+        static constexpr int nHashes = 4;
+
+        std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+        uint64_t mask_ { 0 }; // number of bits - 1
+
+        mutable std::atomic<uint64_t> hits_ { 0 };
+        mutable std::atomic<uint64_t> misses_ { 0 };
+
+    public:
+        FingerprintFilter() = default;
+
+        /**
+         * Empties the filter and sizes it for the given number of
+         * fingerprints.
+         *
+         * PRE: No other thread is using the filter.
+         */
+        void reserve(size_t n) {
+            uint64_t nBits = 64;
+            while (nBits < 16 * uint64_t(n))
+                nBits <<= 1;
+            bits_.reset(new std::atomic<uint64_t>[nBits / 64]);
+            for (uint64_t i = 0; i < nBits / 64; ++i)
+                bits_[i].store(0, std::memory_order_relaxed);
+            mask_ = nBits - 1;
+            hits_ = misses_ = 0;
+        }
+
+        /**
+         * Returns the filter to its initial state, in which it contains
+         * everything.
+         *
+         * PRE: No other thread is using the filter.
+         */
+        void clear() {
+            bits_.reset();
+            mask_ = 0;
+            hits_ = misses_ = 0;
+        }
+
+        /**
+         * Determines whether the filter is in use, i.e., whether reserve()
+         * has been called.
+         */
+        bool enabled() const {
+            return bool(bits_);
+        }
+
+        void add(uint64_t fp) {
+            if (! bits_)
+                return;
+            uint64_t h2 = (fp >> 32) | 1;
+            for (int i = 0; i < nHashes; ++i, fp += h2) {
+                uint64_t b = fp & mask_;
+                bits_[b >> 6].fetch_or(uint64_t(1) << (b & 63),
+                    std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Returns false if no fingerprint equal to fp has been added, or
+         * true if one might have been.  Updates the hit/miss counters.
+         */
+        bool mayContain(uint64_t fp) const {
+            if (! bits_)
+                return true;
+            uint64_t h2 = (fp >> 32) | 1;
+            for (int i = 0; i < nHashes; ++i, fp += h2) {
+                uint64_t b = fp & mask_;
+                if (! (bits_[b >> 6].load(std::memory_order_relaxed) &
+                        (uint64_t(1) << (b & 63)))) {
+                    misses_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * Returns the number of queries that passed the filter (and so
+         * still needed an isosig).
+         */
+        uint64_t hits() const {
+            return hits_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the number of queries that were rejected by the filter
+         * (each of which saved an isosig).
+         */
+        uint64_t misses() const {
+            return misses_.load(std::memory_order_relaxed);
+        }
+
+        FingerprintFilter(const FingerprintFilter&) = delete;
+        FingerprintFilter& operator = (const FingerprintFilter&) = delete;
+};
@@ -1,185 +1,357 @@
 #include "boilerplate.h"
+#include "concurrentset.h"
+#include "shard.h"
+#include "tuner.h"
+#include "walk.h"
 #include <math.h>
 #include <random>
 #include <iostream>
 #include <ctime>
+#include <chrono>
 #include <algorithm>
+#include <unordered_set>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared table of every isosig visited in a collision search, tagged with
+// the index of the component whose walk visited it first.
+using VisitTable = ConcurrentSigMap<uint32_t>;
 
-// Global variables to be place in proper place later.
-int targetVertices = -1;
-int targetPentachora = -1;
+/*
+# explore: random walk that records every state it visits, of any size
+#
+# tri:		start state; replaced by the state the walk ends in
+# origin:	tag of the component the walk belongs to
+# visited:	shared table of visited states, tagged by origin
+# collisions:	collects the isosigs of visited states that already carry a
+#		different tag
+# length:	number of moves to make
+# xx, balance, scaling:	as for step()
+*/
+bool explore(regina::Triangulation<4>& tri, uint32_t origin, VisitTable& visited, std::vector<std::string>& collisions, int length, double xx, int balance, double scaling) {
+	MoveIndex index;
+	Tri4 state(tri);
 
-double randd() {
-	return ((double)rand() / (RAND_MAX + 1.0));
+	for (int st = 0; st < length; ++st) {
+		double b = beta(state.size(),balance,scaling);
+		if (not perform(state,index,xx,b,targetVertices,0,9999)) {
+			std::cout <<  "found bad triangulations" << std::endl;
+			tri = state.toRegina();
+			return false;
+		}
+		std::string sig = state.isoSig();
+		auto res = visited.insert(sig, [origin](const std::string&) { return origin; });
+		if (! res.second && res.first != origin)
+			collisions.push_back(std::move(sig));
+	}
+	tri = state.toRegina();
+	return true;
 }
 
-/* penalty for moving away from balance */
-double beta(int n, int balance, double scaling) {
-	double ans;
-	(double)balance;
-	(double)n;
-		
-	ans = exp(scaling*(balance-n));
-	ans = ans/(1+ans);
-	return ans;
-}
 
 /*
-# pick move: pick move to eventually change number of vertices
+# collide: meet-in-the-middle search joining all remaining components
 #
-# tri:		state triangulation
-# xx:		threshold to try 3-3-move (in G(x,y) we have xx = 1 - 2(x+y))
-# b:		threshold to do 2-4- over 2-0-move (edge or triangle)
-# verts:	target number of vertices
+# census:	triangulation set; only ever modified on the calling thread
+# pool:		workers that run explore() from each component
+# visited:	shared table of visited states, as filled in by explore()
+# onMerge:	called with the colliding isosig after each successful merge
+#
+# One walk runs from every component at the start of the search, and each
+# walk continues from where its last batch of moves ended.  Whenever a
+# walk visits a state that a walk from another component has already
+# visited, the two components are merged.  Returns once a single component
+# remains.
 */
-bool perform(regina::Triangulation<4>& tri, double xx, double b, int verts, int lowerBound, int upperBound) {
-	int v = tri.countVertices();
-	int e = tri.countEdges();
-	int f = tri.countTriangles();
-	int tet = tri.countTetrahedra();
-	
-	/*std::vector<int> lst_e(e);
-	std::iota(std::begin(lst_e),std::end(lst_e),0);
-	std::vector<int> lst_f(f);
-	std::iota(std::begin(lst_f),std::end(lst_f),0);
-	std::vector<int> lst_tet(tet);
-	std::iota(std::begin(lst_tet),std::end(lst_tet),0);*/
-	
-	bool check;
-	double x, y;
-	
-	if (v < verts) {
-		while (v < verts) {
-			tri.pachner(tri.pentachoron(0), false, true);
-			return true;
-		}
-	} else if (v > verts) {
-		// try edge collapse
-		//std::random_shuffle(lst_e.begin(), lst_e.end());
-		for (int i = 0; i < e; i++) {
-			//if (tri.collapseEdge(tri.edge(lst_e[i]), true, true)) {
-			if (tri.collapseEdge(tri.edge(i), true, true)) {
-				return true;
-			}
-		}
+template <typename Callback>
+void collide(TriangulationSet& census, WalkPool& pool, VisitTable& visited, Callback&& onMerge) {
+	std::vector<Component> origins;
+	for (Component c = census.components(); c; ++c)
+		origins.push_back(c);
+
+	for (size_t i = 0; i < origins.size(); ++i) {
+		WalkJob job { origins[i], origins[i].rep() };
+		job.origin = i;
+		// A walk that reaches another component's start point joins it.
+		visited.insert(job.tri.isoSig<regina::IsoSigEdgeDegrees<4>>(),
+			[i](const std::string&) { return uint32_t(i); });
+		pool.submit(std::move(job));
 	}
-	// edge collapse failed
-	x = randd();
-	if (x > xx && tri.size() >= lowerBound) {
-		// try 3-3 move
-		//std::random_shuffle(lst_f.begin(), lst_f.end());
-		for (int i = 0; i < f; i++) {
-			//if (tri.pachner(tri.triangle(lst_f[i]), true, true)) {
-			if (tri.pachner(tri.triangle(i), true, true)) {
-				return true;
-			}
+
+	while (pool.inFlight() > 0) {
+		WalkJob job = pool.collect();
+		for (const std::string& sig : job.seen) {
+			uint32_t other;
+			if (visited.find(sig, other) &&
+					census.merge(origins[other], origins[job.origin]))
+				onMerge(sig);
 		}
+		if (census.countComponents() > 1)
+			pool.submit(std::move(job));
 	}
-	// 3-3-move not executed, check if 2-0-move should be performed
-	y = randd();
-	if (y > b && tri.size() >= lowerBound) {
-		// case very likely if state is larger than target
-		// try going down using 2-0 edge or triangle moves
-		for (int i = 0; i < e; i++) {
-			//if (tri.twoZeroMove(tri.edge(lst_e[i]), true, true)) {
-			if (tri.twoZeroMove(tri.edge(i), true, true)) {
-				return true;
-			}
-		}
-		for (int i = 0; i < f; i++) {
-			//if (tri.twoZeroMove(tri.triangle(lst_f[i]), true, true)) {
-			if (tri.twoZeroMove(tri.triangle(i), true, true)) {
-				return true;
+}
+
+/*
+# bfs: exhaustive search from a component, up to a bound on its size
+#
+# census:	triangulation set; must not be modified during the search
+# start:	component whose representative the search starts from
+# maxSize:	largest number of pentachora to visit
+# threads:	number of threads to search with
+#
+# Visits every triangulation reachable from the representative of start by
+# 2-4, 3-3 and 2-0 moves without exceeding maxSize pentachora.  None of
+# these moves change the number of vertices, so every state has the same
+# number of vertices as the representative.  The search runs level by
+# level, with each level split between the threads, and the threads share
+# a single visited set.
+#
+# Returns the isosig of the first triangulation found that belongs to a
+# different component of census, or an empty string if there is none.
+*/
+std::string bfs(const TriangulationSet& census, Component start, int maxSize, unsigned threads) {
+	ConcurrentSigMap<uint32_t> visited; // isosig -> level
+	std::atomic<size_t> bytes { 0 }; // rough memory used by visited
+	std::string found;
+	std::atomic<bool> done { false };
+	std::mutex foundMutex;
+
+	std::vector<std::string> frontier;
+	frontier.push_back(start.repHandle()->isoSig<regina::IsoSigEdgeDegrees<4>>());
+	visited.insert(frontier.back(), [](const std::string&) { return 0; });
+
+	for (uint32_t level = 1; ! frontier.empty() && ! done; ++level) {
+		std::vector<std::vector<std::string>> next(std::max(1u, threads));
+		std::atomic<size_t> pos { 0 };
+
+		auto work = [&](std::vector<std::string>& out) {
+			Component from = start; // each thread needs its own copy
+			MoveIndex index;
+			size_t i;
+			while (! done && (i = pos++) < frontier.size()) {
+				Tri4 state(regina::Triangulation<4>::fromIsoSig(frontier[i]));
+				index.refresh(state, true);
+				for (auto m : { MoveIndex::twoFour, MoveIndex::threeThree, MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle }) {
+					if (m == MoveIndex::twoFour && state.size() + 2 > size_t(maxSize))
+						continue;
+					for (const auto& c : index.candidates(m)) {
+						// try the move in place, and take it back at once
+						size_t before = state.mark();
+						if (! index.apply(state, m, c))
+							continue;
+						std::string sig = state.isoSig();
+						state.undo(before);
+						if (! visited.insert(sig, [level](const std::string&) { return level; }).second)
+							continue;
+						bytes += sig.size() + sizeof(std::string) + 4 * sizeof(void*);
+						Component c2 = census.find(sig);
+						if (c2 && ! (c2 == from)) {
+							std::lock_guard<std::mutex> lock(foundMutex);
+							if (! done) {
+								found = sig;
+								done = true;
+							}
+							return;
+						}
+						out.push_back(std::move(sig));
+					}
+				}
 			}
+		};
+
+		if (threads <= 1)
+			work(next[0]);
+		else {
+			std::vector<std::thread> pool;
+			for (unsigned t = 0; t < threads; ++t)
+				pool.emplace_back(work, std::ref(next[t]));
+			for (auto& t : pool)
+				t.join();
 		}
+
+		frontier.clear();
+		for (auto& n : next)
+			for (auto& sig : n)
+				frontier.push_back(std::move(sig));
+		std::cout << "level " << level << ": frontier " << frontier.size() << ", visited " << visited.size() << " (~" << (bytes >> 20) << " MiB)" << std::endl;
 	}
-	// 2-0-move not executed, try 2-4-move instead
-	//std::random_shuffle(lst_tet.begin(), lst_tet.end());
-	if (tri.size() <= upperBound-2) {
-	  for (int i = 0; i < tet; i++) {
-		//if (tri.pachner(tri.tetrahedron(lst_tet[i]), true, true)) {
-		if (tri.pachner(tri.tetrahedron(i), true, true)) {
-			return true;
-		}
-	  }
-	} else {
-	  // no 2-4 move because we reached upper bound:
-	  // try other move (3-3 or 2-0)
-	  for (int i = 0; i < f; i++) {
-		//if (tri.pachner(tri.triangle(lst_f[i]), true, true)) {
-		if (tri.pachner(tri.triangle(i), true, true)) {
-			return true;
+	return found;
+}
+
+/*
+# checkpoint: save the census and the current phase, for --resume
+#
+# file:		checkpoint file; written via a temporary file, so that a crash
+#		while writing leaves the previous checkpoint intact
+# census:	triangulation set
+# phase:	phase to resume in (1, 2 or 3)
+# balance:	preferred size in use by the walks
+*/
+const uint32_t checkpointMagic = 0x4b433444; // "D4CK"
+const uint32_t checkpointVersion = 2; // 2: isosigs stored as packed keys
+
+void writeCheckpoint(const std::string& file, const TriangulationSet& census, uint32_t phase, int balance) {
+	std::string tmp = file + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		int32_t header[6] = { int32_t(checkpointMagic), int32_t(checkpointVersion), int32_t(phase), targetVertices, targetPentachora, balance };
+		writeRaw(out, header, 6);
+		census.save(out);
+		if (! out) {
+			std::cerr << "Could not write checkpoint " << tmp << std::endl;
+			return;
 		}
-	  }
-	  for (int i = 0; i < e; i++) {
-			//if (tri.twoZeroMove(tri.edge(lst_e[i]), true, true)) {
-			if (tri.twoZeroMove(tri.edge(i), true, true)) {
-				return true;
-			}
-	  }
-	  for (int i = 0; i < f; i++) {
-			//if (tri.twoZeroMove(tri.triangle(lst_f[i]), true, true)) {
-			if (tri.twoZeroMove(tri.triangle(i), true, true)) {
-				return true;
-			}
-	  }	
 	}
-	
-	// nothing worked
-	for (int i = 0; i < tet; i++) {
-		//if (tri.pachner(tri.tetrahedron(lst_tet[i]), true, true)) {
-		if (tri.pachner(tri.tetrahedron(i), true, true)) {
-			return true;
-		}
-	}	
-	return false;
+	if (std::rename(tmp.c_str(), file.c_str()) != 0)
+		std::cerr << "Could not replace checkpoint " << file << std::endl;
 }
 
+/*
+# resume: load a checkpoint written by writeCheckpoint()
+#
+# Restores the census, the target vertices and pentachora and the balance,
+# and returns the phase to resume in.  Throws std::runtime_error if the checkpoint
+# cannot be read.
+*/
+uint32_t readCheckpoint(const std::string& file, TriangulationSet& census, int& balance) {
+	std::ifstream in(file, std::ios::binary);
+	if (! in)
+		throw std::runtime_error("Cannot open checkpoint " + file);
+	int32_t header[6];
+	readRaw(in, header, 6);
+	if (uint32_t(header[0]) != checkpointMagic || uint32_t(header[1]) != checkpointVersion)
+		throw std::runtime_error(file + " is not a checkpoint of this version");
+	census.load(in);
+	targetVertices = header[3];
+	targetPentachora = header[4];
+	balance = header[5];
+	return header[2];
+}
 
-
+/*
+# read classes: load sorted class files as known components, for --classes
+#
+# dir:		directory of class files (e.g. Census/6p-Sorted), each holding
+#		the isosigs of triangulations already known to be connected
+# census:	triangulation set; each .esig file in dir, in order of name,
+#		becomes a single component (see TriangulationSet::readComponent())
+#
+# Returns the name of each file (without the directory) and its component.
+# Throws std::runtime_error if the directory or a file cannot be read.
+*/
+std::vector<std::pair<std::string, Component>> readClasses(const std::string& dir, TriangulationSet& census) {
+	DIR* d = ::opendir(dir.c_str());
+	if (! d)
+		throw std::runtime_error("Cannot read directory " + dir + ": " + std::strerror(errno));
+	std::vector<std::string> names;
+	while (struct dirent* e = ::readdir(d)) {
+		std::string name = e->d_name;
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".esig") == 0)
+			names.push_back(name);
+	}
+	::closedir(d);
+	std::sort(names.begin(), names.end());
+
+	std::vector<std::pair<std::string, Component>> ans;
+	for (const std::string& name : names) {
+		Component c = census.readComponent((dir + "/" + name).c_str());
+		if (c)
+			ans.emplace_back(name, c);
+	}
+	return ans;
+}
 
 /*
-# target vertex: connect triangulation to a verts-vertex triangulation
+# write classes: write every component to a class file of its own, for --classes
+#
+# dir:		output directory, created if need be
+# census:	triangulation set
+# classes:	known classes, as returned by readClasses()
 #
-# tri:		state triangulation
-# xx:		threshold to try 3-3-move (in G(x,y) we have xx = 1 - 2(x+y))
-# balance:	preferred size of triangulation
-# scaling:	parameter for severity of penalty to be off balance
+# Each known class is written to a file of the same name as the one it was
+# read from, and every other component to new-N.esig, numbered in order of
+# components.  Isosigs are written in order of ID, so the isosigs of a class
+# file come first, in their original order, followed by any that joined the
+# class.  Classes that turn out to be connected are written to the file of
+# the first: any file of the others left in dir by an earlier run is
+# removed, and each such pair of names is listed in dir/merged.txt.  So are
+# new-N.esig files beyond the new classes of this run.  Returns the number
+# of new classes.  Throws std::runtime_error if a file cannot be written.
 */
-bool step(regina::Triangulation<4>& tri, double xx, int balance, double scaling, int lowerBound, int upperBound) {
-	int vertices = tri.countVertices();
-	int pentachora = tri.size();
-	bool res = false;
-	// steps
-	int st = 0;
-	// penalty
-	double b;
-		
-	while (true) {
-		st++;
-		b = beta(pentachora,balance,scaling);
-		res = perform(tri,xx,b,targetVertices,lowerBound,upperBound);
-		if (not res) {
-			std::cout <<  "found bad triangulations" << std::endl;
-			return false;
-		}
-		//std::cout << tri.isoSig() << "\t" << tri.countVertices() << std::endl;
-		vertices = tri.countVertices();
-		pentachora = tri.size();
-		if (lowerBound < targetPentachora) {
-			if (vertices == targetVertices && pentachora==targetPentachora) {
-				//std::cout <<  st << std::endl;
-				return true; }
-		} else {
-			if (vertices == targetVertices && pentachora==lowerBound) {
-				//std::cout <<  st << std::endl;
-				return true; }
+size_t writeClasses(const std::string& dir, const TriangulationSet& census, const std::vector<std::pair<std::string, Component>>& classes) {
+	if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+		throw std::runtime_error("Cannot create directory " + dir + ": " + std::strerror(errno));
+
+	// output for the component with each root: index into classes, or
+	// classes.size() plus the number of the new class
+	std::unordered_map<NodeId, size_t> out;
+	std::vector<std::pair<size_t, size_t>> merged; // (class, class it joined)
+	for (size_t i = 0; i < classes.size(); ++i)
+		if (! out.emplace(classes[i].second.root(), i).second) {
+			merged.emplace_back(i, out[classes[i].second.root()]);
+			std::cerr << "Note: " << classes[i].first << " is connected to " << classes[merged.back().second].first << "." << std::endl;
 		}
-		if (st%5000000 == 0) {
-			std::cout <<  st << "\t v: " << vertices << "\t p: " << pentachora << std::endl;
+	size_t fresh = 0;
+	for (Component c = census.components(); c; ++c)
+		if (out.emplace(c.root(), classes.size() + fresh).second)
+			++fresh;
+
+	// The new classes are small, so gather them in memory rather than hold a
+	// file open for each.
+	std::vector<std::ofstream> known(classes.size());
+	std::vector<std::vector<std::string>> added(fresh);
+	census.forEachSig([&](const std::string& sig, Component c) {
+		size_t i = out[c.root()];
+		if (i >= classes.size())
+			added[i - classes.size()].push_back(sig);
+		else {
+			if (! known[i].is_open()) {
+				known[i].open(dir + "/" + classes[i].first);
+				if (! known[i])
+					throw std::runtime_error("Cannot write " + dir + "/" + classes[i].first);
+			}
+			known[i] << sig << "\n";
 		}
+	});
+	for (size_t i = 0; i < fresh; ++i) {
+		std::ofstream f(dir + "/new-" + std::to_string(i + 1) + ".esig");
+		for (const std::string& sig : added[i])
+			f << sig << "\n";
+		if (! f)
+			throw std::runtime_error("Cannot write " + dir + "/new-" + std::to_string(i + 1) + ".esig");
+	}
+	for (size_t i = 0; i < classes.size(); ++i)
+		if (known[i].is_open() && ! known[i])
+			throw std::runtime_error("Cannot write " + dir + "/" + classes[i].first);
+
+	// Leave no stale class files behind from an earlier run.
+	for (const auto& m : merged)
+		::unlink((dir + "/" + classes[m.first].first).c_str());
+	for (size_t i = fresh + 1; ::unlink((dir + "/new-" + std::to_string(i) + ".esig").c_str()) == 0; ++i)
+		;
+	::unlink((dir + "/merged.txt").c_str());
+	if (! merged.empty()) {
+		std::ofstream f(dir + "/merged.txt");
+		for (const auto& m : merged)
+			f << classes[m.first].first << "\t" << classes[m.second].first << "\n";
+		if (! f)
+			throw std::runtime_error("Cannot write " + dir + "/merged.txt");
 	}
-	return false;			
+	return fresh;
+}
+
+/*
+# report filter: print how many isosigs the fingerprint filter has saved so far
+*/
+void reportFilter(const TriangulationSet& census) {
+	const FingerprintFilter& f = census.fingerprints();
+	if (! f.enabled())
+		return;
+	std::cout << "Fingerprint filter: " << f.misses() << " isosigs skipped, " << f.hits() << " computed." << std::endl;
 }
 
 void usage(const char* progName, const std::string& error = std::string()) {
@@ -187,7 +359,7 @@ void usage(const char* progName, const std::string& error = std::string()) {
         std::cerr << error << "\n\n";
     }
     std::cerr << "Usage:" << std::endl;
-    std::cerr << "      " << progName << " { census file } [ -v=targetVertices ] [ -p=targetPentachora ] \n";
+    std::cerr << "      " << progName << " { census file } [ -v=targetVertices ] [ -p=targetPentachora ] [ -j=threads ] [ -i ] [ -c ] [ -b=maxPentachora ] [ -k=minutes ] [ -r=restartPolicy ] [ -a ] [ -s=seed ] [ -w=workers ] [ -e=width[:depth] ] [ --resume ] [ --stats=file ] [ --certificates=file ] [ --disk=directory[:MiB] ] [ --classes=directory[:output] ] \n";
     exit(1);
 }
 
@@ -197,17 +369,118 @@ bool argCharComp(char arr[], char c) {
 
 int main(int argc, char* argv[]) {
     std::string rawCensusFile;
+    unsigned threads = 1;
+    bool intermediate = false;
+    bool collisions = false;
+    int searchBound = 0;
+    int checkpointMinutes = 0;
+    bool resume = false;
+    std::string statsFile;
+    std::string certificateFile;
+    RestartPolicy restartPolicy;
+    bool adaptive = false;
+    // use different random seed for every run, unless given
+    uint64_t randomSeed = time(0);
+    unsigned processes = 1;
+    int beamWidth = 0;
+    int beamDepth = 100;
+    std::string diskDir;
+    size_t diskMiB = 1024;
+    std::string classDir;
+    std::string classOutDir;
     if (argc < 2) {
         usage(argv[0], "Error: No census file provided.");
     }
     if (2 < argc) {
         for (int i=2; i<argc; ++i) {
-            if (argCharComp(argv[i],'v')) {
+            if (std::strcmp(argv[i],"--resume") == 0) {
+                // carry on from the last checkpoint for this census file
+                resume = true;
+            }
+            else if (std::strncmp(argv[i],"--stats=",8) == 0) {
+                // per-phase counters and timings, as CSV
+                statsFile = argv[i]+8;
+            }
+            else if (std::strncmp(argv[i],"--certificates=",15) == 0) {
+                // record the moves behind every merge, for verify
+                certificateFile = argv[i]+15;
+            }
+            else if (std::strncmp(argv[i],"--disk=",7) == 0) {
+                // keep the census on disk, e.g. --disk=/scratch:4096
+                std::string spec = argv[i]+7;
+                size_t colon = spec.rfind(':');
+                diskDir = spec.substr(0, colon);
+                if (colon != std::string::npos)
+                    diskMiB = std::stoul(spec.substr(colon+1));
+                if (diskDir.empty() || diskMiB == 0)
+                    usage(argv[0], "The disk directory and memory limit must not be empty.");
+            }
+            else if (std::strncmp(argv[i],"--classes=",10) == 0) {
+                // add the census to known classes, e.g. --classes=Census/6p-Sorted
+                std::string spec = argv[i]+10;
+                size_t colon = spec.find(':');
+                classDir = spec.substr(0, colon);
+                classOutDir = (colon != std::string::npos ? spec.substr(colon+1) : classDir + "-Updated");
+                if (classDir.empty() || classOutDir.empty())
+                    usage(argv[0], "The class directories must not be empty.");
+            }
+            else if (argCharComp(argv[i],'v')) {
                 targetVertices = std::stoi(argv[i]+=2);
             }
             else if (argCharComp(argv[i],'p')) {
                 targetPentachora = std::stoi(argv[i]+=2);
             }
+            else if (argCharComp(argv[i],'j')) {
+                // -j on its own means one thread per core
+                threads = (argv[i][2] ? std::stoi(argv[i]+2) :
+                    std::thread::hardware_concurrency());
+            }
+            else if (argCharComp(argv[i],'i')) {
+                // merge every census hit along a walk, not just where it ends
+                intermediate = true;
+            }
+            else if (argCharComp(argv[i],'c')) {
+                // finish with a collision search instead of plain walks
+                collisions = true;
+            }
+            else if (argCharComp(argv[i],'b')) {
+                // exhaustive search from each final component
+                searchBound = std::stoi(argv[i]+2);
+            }
+            else if (argCharComp(argv[i],'k')) {
+                // checkpoint interval
+                checkpointMinutes = std::stoi(argv[i]+2);
+            }
+            else if (argCharComp(argv[i],'r')) {
+                // step budgets for each walk, e.g. -rluby:10000
+                try {
+                    restartPolicy = RestartPolicy::parse(argv[i]+2);
+                } catch (const std::exception& e) {
+                    usage(argv[0], e.what());
+                }
+            }
+            else if (argCharComp(argv[i],'a')) {
+                // choose walk parameters online instead of fixing them
+                adaptive = true;
+            }
+            else if (argCharComp(argv[i],'s')) {
+                // random seed, to repeat a run
+                randomSeed = std::stoull(argv[i]+2);
+            }
+            else if (argCharComp(argv[i],'w')) {
+                // walk in separate worker processes, with a reducer
+                processes = std::stoi(argv[i]+2);
+            }
+            else if (argCharComp(argv[i],'e')) {
+                // beam search instead of random walks, e.g. -e16:200
+                std::string spec = argv[i]+2;
+                size_t colon = spec.find(':');
+                beamWidth = std::stoi(spec.substr(0, colon));
+                if (colon != std::string::npos)
+                    beamDepth = std::stoi(spec.substr(colon+1));
+                if (beamWidth <= 0 || beamDepth <= 0)
+                    usage(argv[0], "Beam width and depth must be positive.");
+            }
             else {
                 usage(argv[0],std::string("Invalid Option: ")+argv[i]);
             }
@@ -218,8 +491,8 @@ int main(int argc, char* argv[]) {
 //    }
     const char* censusFile = rawCensusFile.c_str();
     
-// use different random seed for every run
-srand((unsigned)time(0));
+seedWalks(randomSeed);
+std::cout << "Random seed: " << randomSeed << std::endl;
 
 // parameters
 
@@ -234,8 +507,6 @@ double scaling = 1.0;
 // steps
 int steps = 100;
 
-// result of merging
-bool res;
 // number of components in union find data structure
 int numComponents;
 // progress counters
@@ -244,23 +515,118 @@ int cctr = 0;
 
 // for final approach
 int lowerBound = 10;
-regina::Triangulation<4> copy;
 
 // for timing
 int tm = time(NULL);
 
 
-// representative triangulation of current connected component
-regina::Triangulation<4> rep;
-
 // output from search through Pachner graph
 regina::Triangulation<4> curTriangulation, seed;
 
 
 // Load census into triangulation set data union find data structure
-std::cout << "Load census ";
-TriangulationSet census(censusFile);
-std::cout << " ...done: " << census.countComponents() << " triangulations loaded." << std::endl;
+TriangulationSet census;
+if (! classDir.empty()) {
+	if (resume || checkpointMinutes > 0)
+		usage(argv[0], "Checkpoints (-k, --resume) are not supported with known classes (--classes).");
+	if (processes > 1 || searchBound > 0 || collisions)
+		usage(argv[0], "Known classes (--classes) only support random walks and beam search on threads.");
+}
+if (! diskDir.empty()) {
+	if (processes > 1)
+		usage(argv[0], "Worker processes (-w) cannot share a census kept on disk (--disk).");
+	try {
+		census.storeOnDisk(diskDir, diskMiB << 20);
+	} catch (const std::exception& e) {
+		usage(argv[0], e.what());
+	}
+	std::cout << "Keeping the census in " << diskDir << " with about " << diskMiB << " MiB resident." << std::endl;
+}
+std::string checkpointFile = rawCensusFile + ".ckpt";
+// phase to start in: 1 unless resuming
+uint32_t phase = 1;
+// known classes, with the file each was read from, if --classes was given
+std::vector<std::pair<std::string, Component>> classes;
+if (resume) {
+	std::cout << "Resume from " << checkpointFile;
+	try {
+		phase = readCheckpoint(checkpointFile, census, balance);
+	} catch (const std::exception& e) {
+		std::cout << std::endl;
+		usage(argv[0], e.what());
+	}
+	std::cout << " ...done: " << census.size() << " triangulations in " << census.countComponents() << " components, resuming in phase " << phase << "." << std::endl;
+} else {
+	if (! classDir.empty()) {
+		std::cout << "Load classes from " << classDir;
+		try {
+			classes = readClasses(classDir, census);
+		} catch (const std::exception& e) {
+			std::cout << std::endl;
+			usage(argv[0], e.what());
+		}
+		if (classes.empty()) {
+			std::cout << std::endl;
+			usage(argv[0], "No class files (*.esig) in " + classDir + ".");
+		}
+		std::cout << " ...done: " << census.size() << " triangulations in " << classes.size() << " classes." << std::endl;
+	}
+	std::cout << "Load census ";
+	auto loadStart = std::chrono::steady_clock::now();
+	size_t loadedBefore = census.size();
+	size_t duplicates = 0;
+	try {
+		duplicates = census.read(censusFile, std::max(1u, threads));
+	} catch (const std::exception& e) {
+		std::cout << std::endl;
+		usage(argv[0], e.what());
+	}
+	std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - loadStart;
+	std::cout << " ...done: " << census.size() - loadedBefore << " triangulations loaded in " << loadTime.count() << " seconds";
+	if (duplicates)
+		std::cout << " (" << duplicates << " duplicates skipped)";
+	std::cout << "." << std::endl;
+}
+
+// certificates for every merge, if requested
+std::unique_ptr<CertificateWriter> certs;
+if (! certificateFile.empty()) {
+	if (processes > 1)
+		usage(argv[0], "Certificates cannot be recorded in worker processes (-w).");
+	try {
+		certs.reset(new CertificateWriter(certificateFile, resume));
+	} catch (const std::exception& e) {
+		usage(argv[0], e.what());
+	}
+	if (searchBound > 0 || collisions)
+		std::cerr << "Note: merges found by -b and -c are not certified." << std::endl;
+	if (! classDir.empty())
+		std::cerr << "Note: the known classes are taken as given; only walks from new triangulations are certified." << std::endl;
+}
+// write out the certificates so far: a run whose certificates are lost
+// cannot be verified, so give up if they cannot be written
+auto flushCertificates = [&]() {
+	if (! certs)
+		return;
+	try {
+		certs->flush();
+	} catch (const std::exception& e) {
+		usage(argv[0], e.what());
+	}
+};
+
+// write a checkpoint if one is due (or if forced), to resume in the given phase
+int lastCheckpoint = time(NULL);
+auto checkpoint = [&](uint32_t resumePhase, bool force) {
+	if (checkpointMinutes <= 0)
+		return;
+	if (! force && time(NULL) - lastCheckpoint < 60 * checkpointMinutes)
+		return;
+	// every merge in the checkpoint must be certified on disk
+	flushCertificates();
+	writeCheckpoint(checkpointFile, census, resumePhase, balance);
+	lastCheckpoint = time(NULL);
+};
 
     /*
      If no targetVertices or targetPentachora were given at runtime,
@@ -280,6 +646,14 @@ std::cout << " ...done: " << census.countComponents() << " triangulations loaded
     
     std::cerr << "Target vertices: " << targetVertices << ", Target pentachora: " << targetPentachora << std::endl;
 
+    if (intermediate) {
+        // Most states seen along a walk are not in the census; fingerprint
+        // the census so that these can be ruled out without an isosig.
+        std::cout << "Fingerprint census ";
+        census.indexFingerprints(2 * census.size());
+        std::cout << " ...done." << std::endl;
+    }
+
 /* first iteration through data structure:
 
 If triangulation has two vertices: connect it to some other 2-vertex, 
@@ -292,57 +666,171 @@ Important: first argument of merge becomes component representative
 and must be the 2-vertex triangulation
 
 */
-for (Component curcomp = census.components(); curcomp; ++curcomp) {
-	curTriangulation = curcomp.rep();
-	//std::cout << curTriangulation.countVertices() << " vertices" << std::endl;	
-	step(curTriangulation,xx,balance,scaling,0,9999);
-	//std::cout << curTriangulation.isoSig() << "\t" << rep.isoSig() << std::endl;
-	res = census.merge(curcomp,curTriangulation,false);
-	//if (res) std::cout << "MERGED" << std::endl;
-	ctr++;
-	std::cout << ctr << " triangulations processed in step one. " << census.countComponents() << " components, " << std::endl;
-	//std::cout << time(NULL) - tm << " seconds elapsed. " << std::endl;
-	
+// in adaptive mode, every walk uses parameters chosen by the tuner
+WalkTuner tuner(targetPentachora);
+if (beamWidth > 0 && adaptive)
+	usage(argv[0], "Beam search (-e) has no walk parameters to tune (-a).");
+if (processes > 1 && adaptive)
+	usage(argv[0], "Walk parameters cannot be tuned (-a) across worker processes (-w).");
+auto walker = [&](WalkJob& job) {
+	if (beamWidth > 0)
+		return beam(job.tri,beamWidth,beamDepth,0,9999,intermediate ? &job.seen : nullptr,&census.fingerprints(),certs ? &job.path : nullptr);
+	if (! adaptive)
+		return step(job.tri,xx,balance,scaling,0,9999,intermediate ? &job.seen : nullptr,&census.fingerprints(),&restartPolicy,certs ? &job.path : nullptr);
+	job.arm = tuner.choose();
+	const WalkParams& p = tuner.params(job.arm);
+	double start = threadSeconds();
+	bool ok = step(job.tri,p.xx,p.balance,p.scaling,0,p.upperBound,intermediate ? &job.seen : nullptr,&census.fingerprints(),&restartPolicy,certs ? &job.path : nullptr);
+	job.seconds = threadSeconds() - start;
+	return ok;
+};
+// worker processes fork from this one, which must therefore stay single-threaded
+bool sharded = (processes > 1 && phase <= 2);
+WalkPool pool(sharded ? 0 : threads, walker);
+if (sharded)
+	std::cerr << "Walking in " << processes << " worker processes." << std::endl;
+else
+	std::cerr << "Walking on " << std::max(1u, threads) << " thread(s)." << std::endl;
+if (beamWidth > 0) {
+	std::cerr << "Searching with a beam of width " << beamWidth << ", up to " << beamDepth << " moves at a time." << std::endl;
+	if (restartPolicy.kind != RestartPolicy::none)
+		std::cerr << "Note: beam search ignores the restart policy (-r)." << std::endl;
+}
+if (adaptive)
+	std::cerr << "Choosing walk parameters among " << tuner.size() << " settings." << std::endl;
+// feed the outcome of a walk back to the tuner
+auto learn = [&](const WalkJob& job, bool res) {
+	if (job.arm >= 0)
+		tuner.record(job.arm, res, job.seconds);
+};
+// report what the tuner has learnt so far
+auto reportTuner = [&]() {
+	if (! adaptive)
+		return;
+	std::cout << "Best walk parameters so far: " << tuner.params(tuner.best()) << std::endl;
+	tuner.report(std::cout);
+};
+
+// instrumentation, written out at the end of each phase
+#ifndef NO_STATS
+std::ofstream statsOut;
+Stats::Totals statsSince = Stats::totals();
+if (! statsFile.empty()) {
+	statsOut.open(statsFile);
+	statsOut << "phase,metric,value" << std::endl;
+	Stats::setTiming(true);
+}
+auto dumpStats = [&](const char* phaseName) {
+	if (statsOut.is_open())
+		Stats::dump(statsOut, phaseName, statsSince);
+};
+#else
+if (! statsFile.empty())
+	std::cerr << "Built with NO_STATS: --stats ignored." << std::endl;
+auto dumpStats = [](const char*) {};
+#endif
+
+if (! classes.empty()) {
+	/* incremental classification: walk only from components that contain
+	no known class, until each has joined a class or has failed so often that
+	it is left as a new class */
+	std::vector<size_t> before;
+	for (const auto& c : classes)
+		before.push_back(c.second.size());
+	auto isNew = [&](const Component& c) {
+		for (const auto& k : classes)
+			if (k.second == c)
+				return false;
+		return true;
+	};
+	Scheduler scheduler(census, steps + 1, isNew, 10 * (steps + 1));
+	std::cout << scheduler.queued() << " components to classify." << std::endl;
+	schedule(census, pool, scheduler, 0, [&](const WalkJob& job, bool res) {
+		learn(job, res);
+		if (res) {
+			numComponents = census.countComponents();
+			std::cout << "number of connected components " << numComponents << std::endl;
+		}
+	}, certs.get());
+
+	for (size_t i = 0; i < classes.size(); ++i)
+		if (classes[i].second.size() > before[i])
+			std::cout << classes[i].first << " gained " << classes[i].second.size() - before[i] << " triangulations." << std::endl;
+	size_t fresh = 0;
+	try {
+		fresh = writeClasses(classOutDir, census, classes);
+	} catch (const std::exception& e) {
+		usage(argv[0], e.what());
+	}
+	std::cout << fresh << " new classes (" << scheduler.abandoned() << " given up on), all classes written to " << classOutDir << "." << std::endl;
+	if (certs) {
+		flushCertificates();
+		std::cout << certs->count() << " certificates written to " << certificateFile << "." << std::endl;
+	}
+	reportFilter(census);
+	reportTuner();
+	dumpStats("classes");
+	return 0;
+}
+
+if (sharded) {
+	/* the workers take over the first two phases and the walks of the
+	third: walk until the census is a single component */
+	try {
+		shard(census, processes, walker, steps + 1, 1, learn, [&]() {
+			numComponents = census.countComponents();
+			std::cout << "number of connected components " << numComponents << std::endl;
+			checkpoint(2, false);
+		});
+	} catch (const std::exception& e) {
+		usage(argv[0], e.what());
+	}
+	phase = 3;
+	checkpoint(3, true);
+}
+
+if (phase <= 1) {
+	sweep(census, pool, 1, 0, [&](const WalkJob& job, bool res) {
+		learn(job, res);
+		ctr++;
+		std::cout << ctr << " triangulations processed in step one. " << census.countComponents() << " components, " << std::endl;
+		checkpoint(1, false);
+	}, certs.get());
+	checkpoint(2, true);
 }
 
 std::cout << "STEP ONE:" << time(NULL) - tm << " seconds." << std::endl;
 
 tm = time(NULL);
 
-/* second step keeps on running through connected components until 
-number of components is less than 10 */
+/* second step keeps on walking from connected components, in order of
+priority, until number of components is at most 10 */
 
 std::cout << "DONE WITH FIRST PART." << std::endl;
+reportFilter(census);
+reportTuner();
+dumpStats("phase1");
 
 ctr = 0;
 // get number of components
 numComponents = census.countComponents();
-while (numComponents > 10) {
+while (phase <= 2 && numComponents > 10) {
 	ctr++;
-	// get first component
-	for (Component curcomp = census.components(); curcomp; ++curcomp) {
-		curTriangulation = curcomp.rep();
-		res = false;
-		for (int st = 0; st <= steps; st++) {
-			step(curTriangulation,xx,balance,scaling,0,9999);
-			res = census.merge(curcomp,curTriangulation,false);
-			if (res) {
-				numComponents = census.countComponents();
-				if (numComponents > 20) {
-					numComponents = census.countComponents();
-					std::cout << "number of connected components " << numComponents << std::endl;
-					break;
-				} else {
-					std::cout << "number of connected components " << numComponents << std::endl;
-					for (Component ccomp = census.components(); ccomp; ++ccomp) {
-						rep = ccomp.rep();
-						std::cout << rep.isoSig() << "\t has size \t" << ccomp.size() << std::endl;
-					}
-					break;
+	// walk from whichever component is due, until at most 10 remain
+	Scheduler scheduler(census, steps + 1);
+	schedule(census, pool, scheduler, 10, [&](const WalkJob& job, bool res) {
+		learn(job, res);
+		checkpoint(2, false);
+		if (res) {
+			numComponents = census.countComponents();
+			std::cout << "number of connected components " << numComponents << std::endl;
+			if (numComponents <= 20) {
+				for (Component ccomp = census.components(); ccomp; ++ccomp) {
+					std::cout << ccomp.repHandle()->isoSig() << "\t has size \t" << ccomp.size() << std::endl;
 				}
-			} 
+			}
 		}
-	}
+	}, certs.get());
 	numComponents = census.countComponents();
 	std::cout << "run " << ctr << " complete: " << numComponents << " connected components" << std::endl;
 }
@@ -351,37 +839,92 @@ std::cout << "STEP ONE:" << time(NULL) - tm << " additional seconds." << std::en
 tm = time(NULL);
 
 std::cout << "DONE WITH SECOND PART." << std::endl;
-
-
-balance = targetPentachora * 2;
-scaling = 0.9;
+reportFilter(census);
+reportTuner();
+dumpStats("phase2");
+if (phase <= 2)
+	checkpoint(3, true);
+
+
+if (adaptive) {
+	// the collision search still walks with fixed parameters: use the best so far
+	const WalkParams& p = tuner.params(tuner.best());
+	xx = p.xx;
+	balance = p.balance;
+	scaling = p.scaling;
+} else {
+	balance = targetPentachora * 2;
+	scaling = 0.9;
+}
 std::cout << "Changing balance and scaling to " << balance << " and " << scaling << "." << std::endl;
 numComponents = census.countComponents();
-while (numComponents > 1) {
-	// get first component
-	for (Component curcomp = census.components(); curcomp; ++curcomp) {
-		curTriangulation = curcomp.rep();
-		res = false;
-		for (int st = 0; st <= steps; st++) {
-			step(curTriangulation,xx,balance,scaling,0,9999);
-			res = census.merge(curcomp,curTriangulation,false);
-			if (res) {
-				numComponents = census.countComponents();
-				std::cout << "number of connected components " << numComponents << std::endl;
-				for (Component ccomp = census.components(); ccomp; ++ccomp) {
-					rep = ccomp.rep();
-					std::cout << rep.isoSig() << "\t has size \t" << ccomp.size() << std::endl;
-					std::cout << time(NULL)-tm << "\t seconds for last step \t" << ccomp.size() << std::endl;
-					tm = time(NULL);
-				}
+if (searchBound > 0) {
+	/* deterministic fallback: search every triangulation reachable from each
+	component up to searchBound pentachora, until some pass finds nothing */
+	bool progress = true;
+	while (progress && numComponents > 1) {
+		progress = false;
+		std::vector<Component> remaining;
+		for (Component c = census.components(); c; ++c)
+			remaining.push_back(c);
+		for (Component c : remaining) {
+			if (census.countComponents() <= 1)
 				break;
-			} 
+			std::cout << "Exhaustive search from component of size " << c.size() << " up to " << searchBound << " pentachora." << std::endl;
+			std::string sig = bfs(census, c, searchBound, std::max(1u, threads));
+			if (! sig.empty() && census.mergeIfPresent(c, sig)) {
+				progress = true;
+				numComponents = census.countComponents();
+				std::cout << "found " << sig << ": number of connected components " << numComponents << std::endl;
+				checkpoint(3, false);
+			}
 		}
 	}
 	numComponents = census.countComponents();
 }
+if (collisions && numComponents > 1) {
+	/* meet-in-the-middle: walks from all remaining components record every
+	state they visit, and components are merged as soon as their walks
+	cross */
+	std::cout << "Collision search between " << numComponents << " components." << std::endl;
+	VisitTable visited;
+	WalkPool searchPool(threads, [&](WalkJob& job) {
+		return explore(job.tri,job.origin,visited,job.seen,steps,xx,balance,scaling);
+	});
+	collide(census, searchPool, visited, [&](const std::string& sig) {
+		numComponents = census.countComponents();
+		std::cout << "walks met at " << sig << ": number of connected components " << numComponents << std::endl;
+		std::cout << time(NULL)-tm << "\t seconds for last step \t" << visited.size() << " states visited" << std::endl;
+		tm = time(NULL);
+		checkpoint(3, false);
+	});
+}
+while (numComponents > 1) {
+	Scheduler scheduler(census, steps + 1);
+	schedule(census, pool, scheduler, 1, [&](const WalkJob& job, bool res) {
+		learn(job, res);
+		checkpoint(3, false);
+		if (res) {
+			numComponents = census.countComponents();
+			std::cout << "number of connected components " << numComponents << std::endl;
+			for (Component ccomp = census.components(); ccomp; ++ccomp) {
+				std::cout << ccomp.repHandle()->isoSig() << "\t has size \t" << ccomp.size() << std::endl;
+				std::cout << time(NULL)-tm << "\t seconds for last step \t" << ccomp.size() << std::endl;
+				tm = time(NULL);
+			}
+		}
+	}, certs.get());
+	numComponents = census.countComponents();
+}
 
-std::cout << "THEOREM PROVED, HAVE A NICE DAY." << std::endl;		
+std::cout << "THEOREM PROVED, HAVE A NICE DAY." << std::endl;
+if (certs) {
+	flushCertificates();
+	std::cout << certs->count() << " certificates written to " << certificateFile << "." << std::endl;
+}
+reportFilter(census);
+reportTuner();
+dumpStats("phase3");		
 		
 
 
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+#include "stats.h"
+#include "tri4.h"
+
+/**
+ * Keeps track of which moves used by perform() are legal in the current
+ * state of a random walk, so that perform() can pick a legal move at
+ * random instead of scanning every face.
+ *
+ * Every move is checked and performed natively by Tri4 (collapses and 2-0
+ * moves on a triangulation with boundary are handed to regina instead).
+ * The candidates for Pachner and 2-0 moves are simply the faces of the
+ * right degree whose embeddings lie in distinct pentachora, and the
+ * candidates for collapses are the edges with distinct ends; the rest of
+ * the checks are left to Tri4.
+ *
+ * Every candidate is checked again just before it is performed, and a
+ * failed check evicts the candidate.  An evicted face stays out of the
+ * candidate list until it is indexed again, so the lists double as a cache
+ * of the outcomes of these checks.
+ *
+ * The index is kept per face, under the face's smallest embedding
+ * (pentachoron, face number).  Pachner moves leave the identifications of
+ * all faces outside the star alone, so after a Pachner move only the faces
+ * that meet a pentachoron that changed (or a neighbour of one) are removed
+ * and indexed again.  Collapses and 2-0 moves can identify faces anywhere,
+ * so after one of these the whole index is rebuilt.
+ */
+// Heavyweight class, do not copy!
+class MoveIndex {
+    public:
+        enum Move {
+            collapse, // edge collapse
+            threeThree, // 3-3 move about a triangle
+            twoZeroEdge, // 2-0 move about an edge
+            twoZeroTriangle, // 2-0 move about a triangle
+            twoFour, // 2-4 move about a tetrahedron
+            oneFive, // 1-5 move about a pentachoron (never a candidate)
+            nMoves
+        };
+
+        /**
+         * A move about a particular face, given by a pentachoron containing
+         * the face and the vertex mask of the face within it.
+         */
+        struct Candidate {
+            int32_t pent;
+            uint8_t mask;
+            uint32_t key; // slot() of the smallest embedding of the face
+        };
+
+    private:
+        // What the index holds for a single face, stored under the slot()
+        // of its smallest embedding:
+        struct FaceState {
+            uint8_t listed { 0 }; // bit m is set if the face is a candidate for move m
+            uint32_t pos[nMoves] {}; // where the face is in candidates_[m], if listed
+        };
+
+        std::vector<Candidate> candidates_[nMoves];
+        std::vector<FaceState> faces_; // indexed by slot()
+        std::vector<uint32_t> owner_; // for each slot(), the key of its face
+        size_t size_ { 0 }; // number of pentachora when last refreshed
+        bool rebuild_ { true }; // set if the next refresh must start again
+
+        // The current state as a regina triangulation, built on demand for
+        // the moves that Tri4 does not handle:
+        regina::Triangulation<4> mirror_;
+        bool mirrored_ { false };
+
+        // If non-null, every move made by apply() is appended here, as
+        // given by encode():
+        std::vector<uint32_t>* log_ { nullptr };
+
+        // Scratch space, kept between refreshes to avoid reallocation:
+        std::vector<char> dirty_;
+
+    public:
+        MoveIndex() = default;
+
+        /**
+         * Brings the index up to date with the given triangulation.  This
+         * must be called after every change to the triangulation, whether
+         * or not it was made through this index.
+         *
+         * Changes made elsewhere are taken to be Pachner moves (or undoing
+         * them); after any other change, full must be true.  If full is
+         * true then the index is rebuilt from scratch, and all cached
+         * outcomes are discarded.
+         */
+        void refresh(Tri4& tri, bool full = false) {
+            STATS_TIME(statTimeRefresh);
+            mirrored_ = false;
+            const size_t n = tri.size();
+            if (full || rebuild_ || tri.changedAll()) {
+                tri.clearChanges();
+                rebuild_ = false;
+                for (auto& c : candidates_)
+                    c.clear();
+                faces_.assign(25 * n, FaceState());
+                owner_.resize(25 * n);
+                size_ = n;
+                for (int dim = 1; dim <= 3; ++dim)
+                    for (size_t f = 0; f < tri.countFaces(dim); ++f)
+                        index(tri, dim, f);
+                return;
+            }
+
+            // Work out which pentachora have changed since the last refresh,
+            // including any that have since been removed.
+            const size_t old = size_;
+            dirty_.assign(std::max(n, old), false);
+            std::fill(dirty_.begin() + n, dirty_.end(), true);
+            for (int32_t p : tri.changed()) {
+                if (size_t(p) >= n)
+                    continue; // removed by the move
+                // Legality can depend on the pentachora around the star,
+                // so also treat the neighbours as changed.
+                dirty_[p] = true;
+                for (int f = 0; f < 5; ++f)
+                    if (tri.adjacent(p, f) >= 0)
+                        dirty_[tri.adjacent(p, f)] = true;
+            }
+            tri.clearChanges();
+
+            // Remove every old face that met a changed pentachoron.  Any
+            // other face is still there, with the same embeddings.
+            for (size_t p = 0; p < old; ++p)
+                if (dirty_[p])
+                    for (uint32_t s = 25 * p; s < 25 * (p + 1); ++s)
+                        forget(owner_[s]);
+            faces_.resize(25 * n);
+            owner_.resize(25 * n);
+            size_ = n;
+
+            // Index every new face that meets a changed pentachoron, once,
+            // from its first embedding in a changed pentachoron.
+            for (size_t p = 0; p < n; ++p) {
+                if (! dirty_[p])
+                    continue;
+                for (int dim = 1; dim <= 3; ++dim)
+                    for (int f = 0; f < tri4Faces.count[dim]; ++f) {
+                        int32_t face = tri.faceOf(dim, p, f);
+                        size_t deg = tri.degree(dim, face);
+                        for (size_t j = 0; j < deg; ++j) {
+                            auto emb = tri.embedding(dim, face, j);
+                            if (dirty_[emb.pent]) {
+                                if (size_t(emb.pent) == p && emb.face == f)
+                                    index(tri, dim, face);
+                                break;
+                            }
+                        }
+                    }
+            }
+        }
+
+        /**
+         * Returns the number of candidates for the given move.
+         */
+        size_t count(Move m) const {
+            return candidates_[m].size();
+        }
+
+        /**
+         * Performs a move of one of the given types, chosen uniformly at
+         * random among all candidates of those types.  Candidates that fail
+         * their check are dropped, and another is chosen in their place.
+         *
+         * The argument rand() should return a uniform random number in [0,1).
+         *
+         * Returns true if a move was performed, or false if there were no
+         * legal candidates.  After a successful move, refresh() must be
+         * called before the index is used again.
+         *
+         * PRE: The index is up to date with tri.
+         */
+        template <typename Random>
+        bool perform(Tri4& tri, std::initializer_list<Move> moves,
+                Random&& rand) {
+            while (true) {
+                size_t total = 0;
+                for (Move m : moves)
+                    total += candidates_[m].size();
+                if (total == 0)
+                    return false;
+
+                size_t pick = size_t(rand() * total);
+                for (Move m : moves) {
+                    auto& c = candidates_[m];
+                    if (pick >= c.size()) {
+                        pick -= c.size();
+                        continue;
+                    }
+                    if (apply(tri, m, c[pick]))
+                        return true;
+                    unlist(m, pick);
+                    break;
+                }
+            }
+        }
+
+        /**
+         * Returns the candidates for the given move.
+         */
+        const std::vector<Candidate>& candidates(Move m) const {
+            return candidates_[m];
+        }
+
+        /**
+         * Checks and performs the given move.  Returns true if the move was
+         * legal (and has therefore been performed).
+         *
+         * The candidate may be applied to any copy of the triangulation that
+         * the index was last refreshed with, as long as the copy has not
+         * been changed since.  Every move from a single state can thus be
+         * tried in turn, either on copies or on the state itself, taking
+         * each move back with Tri4::undo() before trying the next.
+         */
+        bool apply(Tri4& tri, Move m, const Candidate& c) {
+            STATS_COUNT(StatCounter(int(statTried) + int(m)));
+            STATS_TIME(statTimeMove);
+            bool ok;
+            if (m == threeThree || m == twoFour || m == oneFive)
+                ok = tri.pachner(c.pent, c.mask);
+            else if (tri.hasBoundary())
+                ok = applyRegina(tri, m, c);
+            else {
+                ok = (m == collapse ? tri.collapseEdge(c.pent, c.mask) :
+                    tri.twoZeroMove(c.pent, c.mask));
+                if (ok)
+                    rebuild_ = true;
+            }
+            if (ok) {
+                mirrored_ = false;
+                STATS_COUNT(StatCounter(int(statAccepted) + int(m)));
+                if (log_)
+                    log_->push_back(encode(m, c));
+            }
+            return ok;
+        }
+
+        /**
+         * Makes apply() (and hence perform()) append every move it makes
+         * to the given list, as encoded by encode(), or stops this if log
+         * is null.  Replaying the list through apply() on a copy of the
+         * starting triangulation (see decode()) repeats the moves exactly.
+         */
+        void log(std::vector<uint32_t>* log) {
+            log_ = log;
+        }
+
+        /**
+         * Packs a move into 32 bits: the move type in the low 3 bits, the
+         * vertex mask in the next 5, and the pentachoron in the top 24.
+         */
+        static uint32_t encode(Move m, const Candidate& c) {
+            return (uint32_t(c.pent) << 8) | (uint32_t(c.mask) << 3) | m;
+        }
+
+        /**
+         * Unpacks a move packed by encode().  The candidate's key is not
+         * recorded, and is not needed by apply().
+         */
+        static void decode(uint32_t code, Move& m, Candidate& c) {
+            m = Move(code & 7);
+            c = { int32_t(code >> 8), uint8_t((code >> 3) & 31), 0 };
+        }
+
+        MoveIndex(const MoveIndex&) = delete;
+        MoveIndex& operator = (const MoveIndex&) = delete;
+
+    private:
+        /**
+         * Implements apply() for collapses and 2-0 moves on triangulations
+         * with boundary, which Tri4 does not handle.
+         */
+        bool applyRegina(Tri4& tri, Move m, const Candidate& c) {
+            if (! mirrored_) {
+                mirror_ = tri.toRegina();
+                mirrored_ = true;
+            }
+            auto* p = mirror_.pentachoron(c.pent);
+            int v[3] = { 0, 0, 0 };
+            int nv = 0;
+            for (int i = 0; i < 5 && nv < 3; ++i)
+                if (c.mask & (1 << i))
+                    v[nv++] = i;
+
+            bool ok = false;
+            switch (m) {
+                case collapse:
+                    ok = mirror_.collapseEdge(p->edge(
+                        regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                    break;
+                case twoZeroEdge:
+                    ok = mirror_.twoZeroMove(p->edge(
+                        regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                    break;
+                case twoZeroTriangle:
+                    ok = mirror_.twoZeroMove(p->triangle(
+                        regina::Triangle<4>::triangleNumber[v[0]][v[1]][v[2]]),
+                        true, true);
+                    break;
+                default:
+                    break;
+            }
+            if (ok) {
+                tri.assign(Tri4(mirror_));
+                mirrored_ = false;
+                rebuild_ = true;
+            }
+            return ok;
+        }
+
+        /**
+         * Numbers the edges, triangles and tetrahedra of each pentachoron
+         * consecutively, 25 to a pentachoron.  Tri4 lists the embeddings of
+         * each face in this order.
+         */
+        static uint32_t slot(int32_t pent, int dim, int face) {
+            return 25 * uint32_t(pent) + 10 * (dim - 1) + face;
+        }
+
+        /**
+         * Adds the given face to the candidate list for the given move.
+         */
+        void list(Move m, const Candidate& c) {
+            FaceState& s = faces_[c.key];
+            s.listed |= (1 << m);
+            s.pos[m] = candidates_[m].size();
+            candidates_[m].push_back(c);
+        }
+
+        /**
+         * Removes the candidate at the given position in the list for the
+         * given move, moving the last candidate into its place.
+         */
+        void unlist(Move m, size_t pos) {
+            auto& c = candidates_[m];
+            faces_[c[pos].key].listed &= ~(1 << m);
+            c[pos] = c.back();
+            faces_[c[pos].key].pos[m] = pos;
+            c.pop_back();
+        }
+
+        /**
+         * Removes the face with the given key from every candidate list.
+         */
+        void forget(uint32_t key) {
+            FaceState& s = faces_[key];
+            for (int m = 0; s.listed; ++m)
+                if (s.listed & (1 << m))
+                    unlist(Move(m), s.pos[m]);
+        }
+
+        /**
+         * Works out which moves about the given face are worth trying, and
+         * adds them to the candidate lists.
+         *
+         * PRE: The face is not in any candidate list.
+         */
+        void index(const Tri4& tri, int dim, size_t face) {
+            size_t deg = tri.degree(dim, face);
+            auto e = tri.embedding(dim, face, 0);
+            uint32_t key = slot(e.pent, dim, e.face);
+            for (size_t j = 0; j < deg; ++j) {
+                auto emb = tri.embedding(dim, face, j);
+                owner_[slot(emb.pent, dim, emb.face)] = key;
+            }
+
+            Candidate c { e.pent, uint8_t(tri4Faces.mask[dim][e.face]), key };
+            bool distinct = tri.distinctPentachora(dim, face);
+
+            switch (dim) {
+                case 1: {
+                    int a = -1, b = -1;
+                    for (int i = 0; i < 5; ++i)
+                        if (c.mask & (1 << i))
+                            (a < 0 ? a : b) = i;
+                    if (tri.faceOf(0, c.pent, a) != tri.faceOf(0, c.pent, b))
+                        list(collapse, c);
+                    if (deg == 2 && distinct)
+                        list(twoZeroEdge, c);
+                    break;
+                }
+                case 2:
+                    if (deg == 3 && distinct)
+                        list(threeThree, c);
+                    if (deg == 2 && distinct)
+                        list(twoZeroTriangle, c);
+                    break;
+                case 3:
+                    if (deg == 2 && distinct)
+                        list(twoFour, c);
+                    break;
+            }
+        }
+};
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "triangulation/dim4.h"
+#include "triangulation/isosigtype.h"
+#include "triangulation/detail/isosig-impl.h"
+
+/**
+ * The alphabet of printable isosigs, numbered in ASCII order, as used by
+ * PackedSig.
+ */
+struct PackedSigTables {
+    char alphabet[64] {}; // character for each code
+    uint8_t code[256] {}; // code for each character, or 64 if none
+    uint8_t digit[64] {}; // code for each of regina's base64 digits
+
+    constexpr PackedSigTables() {
+        int next = 0;
+        for (int c = 0; c < 256; ++c) {
+            code[c] = 64;
+            if (c == '+' || c == '-' || (c >= '0' && c <= '9') ||
+                    (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+                alphabet[next] = char(c);
+                code[c] = next++;
+            }
+        }
+        // Regina writes the digits 0-63 as a-z, A-Z, 0-9, + and -.
+        for (int d = 0; d < 64; ++d)
+            digit[d] = code[uint8_t(d < 26 ? 'a' + d : d < 52 ? 'A' + d - 26 :
+                d < 62 ? '0' + d - 52 : d == 62 ? '+' : '-')];
+    }
+};
+
+inline constexpr PackedSigTables packedSigTables {};
+
+/**
+ * An edge-degree isosig packed into binary, for use as a key.
+ *
+ * Printable isosigs use an alphabet of 64 characters.  A key stores each
+ * character in six bits instead of eight, numbered in ASCII order so that
+ * comparing two keys agrees with comparing the isosigs as text.  The bits
+ * are packed big-endian and padded with zeroes, and are preceded by a
+ * single byte holding the number of characters modulo 4 (which is all that
+ * the length of the key leaves open).  A 36-character 6-pentachoron isosig
+ * thus becomes a 28-byte key, and keys are hashed and compared a word at a
+ * time instead of a character at a time.
+ *
+ * Converting between keys and text is pure bit shuffling, and never
+ * decodes a triangulation.
+ *
+ * Keys of up to inlineBytes bytes (isosigs of up to 52 characters) are
+ * held inside the object, without a heap allocation.
+ */
+class PackedSig {
+    public:
+        static constexpr size_t inlineBytes = 40;
+
+    private:
+        uint32_t size_ { 0 }; // bytes in the key
+        uint8_t small_[inlineBytes];
+        std::unique_ptr<uint8_t[]> large_; // the key, if it does not fit
+
+
+    public:
+        /**
+         * Creates the key of the empty isosig.
+         */
+        PackedSig() {
+            small_[0] = 0;
+            size_ = 1;
+        }
+
+        PackedSig(const PackedSig& other) {
+            assign(other.key());
+        }
+
+        PackedSig(PackedSig&& other) noexcept : PackedSig() {
+            swap(other);
+        }
+
+        PackedSig& operator = (const PackedSig& other) {
+            if (this != &other)
+                assign(other.key());
+            return *this;
+        }
+
+        PackedSig& operator = (PackedSig&& other) noexcept {
+            swap(other);
+            return *this;
+        }
+
+        /**
+         * Packs the given printable isosig.  Throws std::invalid_argument if
+         * it contains a character outside the isosig alphabet.
+         */
+        explicit PackedSig(std::string_view text) {
+            std::string key;
+            if (! pack(text, key))
+                throw std::invalid_argument("Not an isosig: " + std::string(text));
+            assign(key);
+        }
+
+        /**
+         * Returns the key as raw bytes, as stored by SigStore.
+         */
+        std::string_view key() const {
+            return std::string_view(reinterpret_cast<const char*>(data()),
+                size_);
+        }
+
+        /**
+         * Returns the printable isosig.
+         */
+        std::string text() const {
+            return text(key());
+        }
+
+        bool empty() const {
+            return size_ == 1 && data()[0] == 0;
+        }
+
+        void swap(PackedSig& other) noexcept {
+            std::swap(size_, other.size_);
+            std::swap(small_, other.small_);
+            large_.swap(other.large_);
+        }
+
+        bool operator == (const PackedSig& other) const {
+            return key() == other.key();
+        }
+
+        bool operator != (const PackedSig& other) const {
+            return key() != other.key();
+        }
+
+        /**
+         * Orders keys exactly as the corresponding isosigs are ordered as
+         * text, which is how regina chooses among candidate isosigs.
+         */
+        bool operator < (const PackedSig& other) const {
+            size_t n = std::min(size_, other.size_) - 1;
+            int c = std::memcmp(data() + 1, other.data() + 1, n);
+            if (c != 0)
+                return c < 0;
+            return chars(key()) < chars(other.key());
+        }
+
+        /**
+         * Appends the given isosig, as regina does to join the isosigs of
+         * the components of a disconnected triangulation.
+         */
+        PackedSig& operator += (const PackedSig& other) {
+            std::string key;
+            pack(text() + other.text(), key);
+            assign(key);
+            return *this;
+        }
+
+        /**
+         * Packs the given printable isosig and appends its key to the given
+         * string.  Returns false (leaving key unchanged) if the isosig
+         * contains a character outside the isosig alphabet.
+         */
+        static bool pack(std::string_view text, std::string& key) {
+            size_t start = key.size();
+            key.resize(start + keyBytes(text.size()));
+            uint8_t* out = reinterpret_cast<uint8_t*>(&key[start]);
+            *out++ = text.size() % 4;
+            // Four characters make three bytes.
+            const uint8_t* in = reinterpret_cast<const uint8_t*>(text.data());
+            for (size_t left = text.size(); left > 0; ) {
+                size_t n = std::min<size_t>(left, 4);
+                uint32_t word = 0, bad = 0;
+                for (size_t i = 0; i < 4; ++i) {
+                    uint32_t code = (i < n ? packedSigTables.code[in[i]] : 0);
+                    bad |= code;
+                    word = (word << 6) | (code & 63);
+                }
+                if (bad & 64) {
+                    key.resize(start);
+                    return false;
+                }
+                out[0] = uint8_t(word >> 16);
+                if (n > 1)
+                    out[1] = uint8_t(word >> 8);
+                if (n > 2)
+                    out[2] = uint8_t(word);
+                in += n;
+                out += 3;
+                left -= n;
+            }
+            return true;
+        }
+
+        /**
+         * Returns the printable isosig with the given key.
+         */
+        static std::string text(std::string_view key) {
+            const uint8_t* in = reinterpret_cast<const uint8_t*>(key.data()) + 1;
+            size_t bytes = key.size() - 1;
+            std::string ans(chars(key), ' ');
+            for (size_t i = 0, j = 0; i < ans.size(); i += 4, j += 3) {
+                uint32_t word = (uint32_t(in[j]) << 16) |
+                    (j + 1 < bytes ? uint32_t(in[j + 1]) << 8 : 0) |
+                    (j + 2 < bytes ? in[j + 2] : 0);
+                for (size_t k = 0; k < 4 && i + k < ans.size(); ++k)
+                    ans[i + k] = packedSigTables.alphabet[(word >> (18 - 6 * k)) & 63];
+            }
+            return ans;
+        }
+
+        /**
+         * Returns the number of characters in the isosig with the given key.
+         */
+        static size_t chars(std::string_view key) {
+            size_t bytes = key.size() - 1;
+            size_t ans = 4 * bytes / 3;
+            if (bytes % 3 == 0 && bytes > 0 && uint8_t(key[0]) == 3)
+                --ans;
+            return ans;
+        }
+
+        /**
+         * Returns the number of bytes in the key of an isosig with the
+         * given number of characters.
+         */
+        static constexpr size_t keyBytes(size_t chars) {
+            return 1 + (6 * chars + 7) / 8;
+        }
+
+        /**
+         * Hashes the given key, eight bytes at a time.  This is a pure
+         * function of the key, and so may be computed on any thread.
+         */
+        static uint64_t hash(std::string_view key) {
+            auto mix = [](uint64_t h) {
+                h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+                h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+                return h ^ (h >> 31);
+            };
+            uint64_t h = key.size();
+            const char* p = key.data();
+            size_t left = key.size();
+            for ( ; left >= 8; p += 8, left -= 8) {
+                uint64_t w;
+                std::memcpy(&w, p, 8);
+                h = mix(h ^ w) + 0x9e3779b97f4a7c15ull;
+            }
+            if (left) {
+                uint64_t w = 0;
+                std::memcpy(&w, p, left);
+                h = mix(h ^ w) + 0x9e3779b97f4a7c15ull;
+            }
+            return mix(h);
+        }
+
+    private:
+        const uint8_t* data() const {
+            return large_ ? large_.get() : small_;
+        }
+
+        void assign(std::string_view key) {
+            std::memcpy(resize(key.size()), key.data(), key.size());
+        }
+
+        /**
+         * Makes room for a key of the given number of bytes, and returns
+         * where to write it.
+         */
+        uint8_t* resize(size_t bytes) {
+            size_ = bytes;
+            if (size_ <= inlineBytes) {
+                large_.reset();
+                return small_;
+            }
+            large_.reset(new uint8_t[size_]);
+            return large_.get();
+        }
+
+    template <int> friend class PackedSigEncoding;
+};
+
+inline void swap(PackedSig& a, PackedSig& b) noexcept {
+    a.swap(b);
+}
+
+/**
+ * Hashes keys with PackedSig::hash(), for use in standard containers.
+ */
+struct PackedSigHash {
+    size_t operator () (const PackedSig& sig) const {
+        return PackedSig::hash(sig.key());
+    }
+};
+
+/**
+ * An isosig encoding for regina's isoSig() that produces packed keys:
+ * tri.isoSig<regina::IsoSigEdgeDegrees<4>, PackedSigEncoding<4>>() is the
+ * key of tri.isoSig<regina::IsoSigEdgeDegrees<4>>().
+ *
+ * Each candidate is written straight into a key, six bits per character,
+ * in the same layout as regina's printable encoding (IsoSigPrintable), so
+ * no text is ever built.  Since keys are ordered as their isosigs are,
+ * regina chooses the same candidate either way.
+ */
+template <int dim>
+class PackedSigEncoding {
+    private:
+        /**
+         * Characters per gluing permutation, as for IsoSigPrintable.
+         */
+        static constexpr unsigned charsPerPerm() {
+            unsigned bits = 0;
+            while ((size_t(1) << bits) < size_t(regina::Perm<dim + 1>::nPerms))
+                ++bits;
+            return (bits + 5) / 6;
+        }
+
+        /**
+         * Writes base64 digits big-endian into a key, as PackedSig::pack()
+         * would write the corresponding characters.
+         */
+        struct Writer {
+            uint8_t* out;
+            uint32_t bits { 0 };
+            int nBits { 0 };
+
+            void digit(unsigned d) {
+                bits = (bits << 6) | packedSigTables.digit[d & 63];
+                nBits += 6;
+                if (nBits >= 8) {
+                    nBits -= 8;
+                    *out++ = uint8_t(bits >> nBits);
+                }
+            }
+
+            // An integer in the given number of digits, lowest first.
+            void integer(size_t value, unsigned nChars) {
+                for (unsigned i = 0; i < nChars; ++i, value >>= 6)
+                    digit(unsigned(value));
+            }
+
+            void finish() {
+                if (nBits > 0)
+                    *out++ = uint8_t(bits << (8 - nBits));
+            }
+        };
+
+    public:
+        using Signature = PackedSig;
+
+        static Signature emptySig() {
+            return PackedSig(regina::IsoSigPrintable<dim>::emptySig());
+        }
+
+        static Signature encode(size_t size, size_t nFacetActions,
+                const uint8_t* facetAction, size_t nJoins,
+                const size_t* joinDest,
+                const typename regina::Perm<dim + 1>::Index* joinGluing) {
+            // One digit per integer for small triangulations; otherwise a
+            // marker (63) and the number of digits per integer come first.
+            unsigned nChars = 1;
+            if (size >= 63)
+                for (size_t tmp = size >> 6; tmp > 0; tmp >>= 6)
+                    ++nChars;
+            size_t chars = (size >= 63 ? 2 : 0) + nChars +
+                (nFacetActions + 2) / 3 + nJoins * (nChars + charsPerPerm());
+
+            PackedSig ans;
+            uint8_t* key = ans.resize(PackedSig::keyBytes(chars));
+            key[0] = chars % 4;
+            Writer w { key + 1 };
+            if (size >= 63) {
+                w.digit(63);
+                w.digit(nChars);
+            }
+            w.integer(size, nChars);
+            // Facet actions are trits, three to a digit, lowest first.
+            for (size_t i = 0; i < nFacetActions; i += 3) {
+                unsigned d = facetAction[i];
+                if (i + 1 < nFacetActions)
+                    d |= unsigned(facetAction[i + 1]) << 2;
+                if (i + 2 < nFacetActions)
+                    d |= unsigned(facetAction[i + 2]) << 4;
+                w.digit(d);
+            }
+            for (size_t i = 0; i < nJoins; ++i)
+                w.integer(joinDest[i], nChars);
+            for (size_t i = 0; i < nJoins; ++i)
+                w.integer(size_t(joinGluing[i]), charsPerPerm());
+            w.finish();
+            return ans;
+        }
+};
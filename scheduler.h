@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "boilerplate.h"
+#include "walkpool.h"
+
+/**
+ * Decides which component the next walk starts from, in place of a sweep
+ * through the list of components in a fixed order.
+ *
+ * Components wait in a priority queue, ordered by the time (counted in
+ * walks handed out) at which they are next due.  A component whose walk
+ * merged nothing goes to the back with a delay of
+ *
+ *     failures * (1 + log2(size))
+ *
+ * walks, where failures counts its walks since it last grew: components
+ * that keep failing are tried less and less often (but never abandoned),
+ * and small components, whose walks have the most of the census to hit,
+ * come round sooner than large ones.  A component that grows is due again
+ * at once, with a clean record.
+ *
+ * Entries are keyed by the root of their component.  An entry whose
+ * component has been merged into another is retired when it reaches the
+ * front of the queue, and is never handed out; a walk that was in flight
+ * from such a component is dropped when it returns.
+ *
+ * The scheduler can also be restricted to some of the components (see the
+ * constructor), and can give up on components that keep failing, which is
+ * how an incremental classification walks only from new triangulations.
+ */
+// Heavyweight class, do not copy!
+class Scheduler {
+    private:
+        struct Record {
+            uint32_t version { 0 }; // matches the queue entry or walk in flight
+            uint32_t failures { 0 }; // walks since the component last grew
+            bool parked { false }; // whether job holds the last walk
+            WalkJob job; // last walk, to continue from
+        };
+
+        // (due, size, root, version); the smallest comes first
+        using Entry = std::tuple<uint64_t, size_t, NodeId, uint32_t>;
+
+        const TriangulationSet& census_;
+        int walks_;
+        std::function<bool(const Component&)> wanted_; // or empty for all
+        int giveUp_; // failures before a component is retired, or 0
+        size_t abandoned_ { 0 };
+        std::unordered_map<NodeId, Record> records_;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>
+            queue_;
+        std::unordered_map<uint32_t, NodeId> flying_; // version -> root
+        uint64_t tick_ { 0 };
+        uint32_t nextVersion_ { 0 };
+
+    public:
+        /**
+         * Queues every current component of the given census, smallest
+         * first.  Each walk continues from the state the last walk from
+         * the same component ended in, except that after every walks
+         * failures in a row the component starts again from its
+         * representative, as in sweep().
+         *
+         * If wanted is given then only components for which it returns true
+         * are queued, both now and when they grow; a walk that merges its
+         * component into an unwanted one retires it.  If giveUp is positive
+         * then a component is retired after giveUp walks in a row that
+         * merge nothing, and counted by abandoned().
+         */
+        Scheduler(const TriangulationSet& census, int walks,
+                std::function<bool(const Component&)> wanted = nullptr,
+                int giveUp = 0) :
+                census_(census), walks_(std::max(1, walks)),
+                wanted_(std::move(wanted)), giveUp_(giveUp) {
+            for (Component c = census.components(); c; ++c)
+                if (! wanted_ || wanted_(c))
+                    queue(c.root(), 0);
+        }
+
+        /**
+         * Returns the number of components queued or in flight.
+         */
+        size_t queued() const {
+            return records_.size();
+        }
+
+        /**
+         * Returns the number of components retired because they kept
+         * failing (see the constructor).
+         */
+        size_t abandoned() const {
+            return abandoned_;
+        }
+
+        /**
+         * Fills in the job for the next walk: either a fresh job from the
+         * representative of the component that is due next, or the last
+         * walk from that component.  Returns false if no component is
+         * queued, which happens when every component has a walk in flight.
+         */
+        bool next(WalkJob& job) {
+            while (! queue_.empty()) {
+                auto [due, size, root, version] = queue_.top();
+                queue_.pop();
+                auto it = records_.find(root);
+                if (it == records_.end() || it->second.version != version)
+                    continue;
+                Component c(&census_, root);
+                if (c.root() != root || (wanted_ && ! wanted_(c))) {
+                    // merged away (or into something unwanted) since it was
+                    // queued
+                    records_.erase(it);
+                    continue;
+                }
+
+                tick_ = std::max(tick_ + 1, due);
+                Record& r = it->second;
+                if (r.parked) {
+                    job = std::move(r.job);
+                    r.parked = false;
+                } else
+                    job = WalkJob { c, c.rep() };
+                job.comp = c;
+                job.origin = version;
+                flying_[version] = root;
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * Takes back a walk handed out by next(), once its results have been
+         * merged, and queues its component again.  The argument merged
+         * should be true if the walk merged anything.
+         */
+        void done(WalkJob&& job, bool merged) {
+            auto f = flying_.find(job.origin);
+            if (f == flying_.end())
+                return;
+            NodeId root = f->second;
+            flying_.erase(f);
+            NodeId now = job.comp.root();
+
+            if (merged) {
+                if (root != now)
+                    records_.erase(root);
+                records_.erase(now);
+                if (! wanted_ || wanted_(job.comp))
+                    queue(now, tick_);
+                return;
+            }
+            auto it = records_.find(root);
+            if (it == records_.end() || it->second.version != job.origin ||
+                    now != root) {
+                // Some other walk has merged this component meanwhile, and
+                // the merged component has been queued afresh.
+                if (it != records_.end() && now != root)
+                    records_.erase(it);
+                return;
+            }
+
+            Record& r = it->second;
+            size_t size = job.comp.size();
+            ++r.failures;
+            if (giveUp_ > 0 && r.failures >= uint32_t(giveUp_)) {
+                records_.erase(it);
+                ++abandoned_;
+                return;
+            }
+            if (r.failures % walks_ != 0) {
+                r.job = std::move(job);
+                r.parked = true;
+            }
+            r.version = nextVersion_++;
+            queue_.emplace(tick_ + uint64_t(std::ceil(r.failures *
+                (1 + std::log2(double(size))))), size, root, r.version);
+        }
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator = (const Scheduler&) = delete;
+
+    private:
+        /**
+         * Queues the component with the given root afresh, due at the
+         * given time.
+         */
+        void queue(NodeId root, uint64_t due) {
+            Record& r = records_[root];
+            r.version = nextVersion_++;
+            queue_.emplace(due, Component(&census_, root).size(), root,
+                r.version);
+        }
+};
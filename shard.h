@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "boilerplate.h"
+#include "walkpool.h"
+#include "xoshiro.h"
+
+/*
+Sharded classification: the components are split between several worker
+processes on one machine, which run the walks and report what they find to
+a single reducer over pipes.
+
+Each line that a worker sends describes one walk,
+
+	A B S1 S2 ...
+
+where A is the isosig of the representative of the component the walk
+started from, B is the isosig of the state the walk ended in, and S1, S2,
+... are any intermediate census states reported by the walk (see step()).
+The reducer applies each line to its union-find exactly as sweep() would,
+and echoes it, prefixed with the number of its sender, to every worker.
+
+Workers apply the echoed lines in the order they arrive, and never change
+their copy of the union-find in any other way, so every process holds the
+same union-find as the reducer, at most one walk behind.  In particular,
+all workers agree on which components remain and on who walks from which.
+*/
+
+/*
+# apply walk: merge the components connected by one walk, given as a line as above
+#
+# returns true if the line merged anything; throws std::runtime_error if
+# the line is malformed or starts from an unknown triangulation
+*/
+inline bool applyWalk(TriangulationSet& census, const std::string& line) {
+	std::istringstream in(line);
+	std::string start, end, sig;
+	if (! (in >> start >> end))
+		throw std::runtime_error("Malformed walk: " + line);
+	Component c = census.find(start);
+	if (! c)
+		throw std::runtime_error("Walk from unknown triangulation: " + start);
+	bool res = false;
+	while (in >> sig)
+		if (census.mergeIfPresent(c, sig))
+			res = true;
+	if (census.mergeSig(c, end, false))
+		res = true;
+	return res;
+}
+
+/*
+# shard worker: walk from this worker's share of the components until told to stop
+#
+# census:	this process's copy of the union-find, only changed by echoed lines
+# worker:	number of this worker, from 0 to workers-1
+# in, out:	pipes from and to the reducer
+# walker:	runs a single walk, as for WalkPool
+# walks:	maximum number of walks from a component in each round (the
+#		first round makes a single walk from each component)
+# onResult:	called after each walk with true if the walk merged anything
+#
+# In each round the worker takes every workers-th component, starting from
+# its own number; if there are fewer components than workers, then several
+# workers share a component.  As in sweep(), the walks from a component
+# continue from one another until one of them merges it, and a component
+# that somebody else's walk merges is left alone for the rest of the round.
+*/
+template <typename Callback>
+void shardWorker(TriangulationSet& census, unsigned worker, unsigned workers, int in, int out, const WalkPool::Walker& walker, int walks, Callback&& onResult) {
+	FILE* from = fdopen(in, "r");
+	FILE* to = fdopen(out, "w");
+	char* buf = nullptr;
+	size_t bufSize = 0;
+
+	// apply echoed lines until one from the given worker (or any, if -1)
+	// arrives; returns whether that line merged anything, or -1 on stop
+	auto receive = [&](long until) -> int {
+		while (true) {
+			ssize_t len = getline(&buf, &bufSize, from);
+			if (len <= 0 || std::strncmp(buf, "stop", 4) == 0)
+				return -1;
+			char* rest;
+			long sender = std::strtol(buf, &rest, 10);
+			bool res = applyWalk(census, std::string(rest, buf + len - rest));
+			if (until < 0 || sender == until)
+				return res;
+		}
+	};
+
+	for (int round = 0; ; ++round) {
+		size_t k = census.countComponents();
+		if (k <= 1) {
+			// nothing to do: wait for the reducer
+			if (receive(-1) < 0)
+				break;
+			continue;
+		}
+		std::vector<Component> mine;
+		size_t i = 0;
+		for (Component c = census.components(); c; ++c, ++i)
+			if (k < workers ? i == worker % k : i % workers == worker)
+				mine.push_back(c);
+
+		for (Component c : mine) {
+			size_t size = c.size();
+			WalkJob job { c, c.rep() };
+			while (job.attempts < (round ? walks : 1) && c.size() == size) {
+				std::string line = c.repSig();
+				job.seen.clear();
+				job.ok = walker(job);
+				++job.attempts;
+				line += ' ';
+				line += job.tri.isoSig<regina::IsoSigEdgeDegrees<4>>();
+				for (const std::string& sig : job.seen) {
+					line += ' ';
+					line += sig;
+				}
+				line += '\n';
+				fputs(line.c_str(), to);
+				fflush(to);
+
+				int res = receive(worker);
+				if (res < 0) {
+					free(buf);
+					fclose(from);
+					fclose(to);
+					return;
+				}
+				onResult(job, bool(res));
+				if (res)
+					break;
+			}
+		}
+	}
+	free(buf);
+	fclose(from);
+	fclose(to);
+}
+
+/*
+# shard: classify on several worker processes until at most stopAt components remain
+#
+# census:	the reducer's union-find; each worker starts from a copy
+# workers:	number of worker processes
+# walker, walks, onResult:	as for shardWorker(), run within each worker
+# onMerge:	called in the reducer after each walk that merged anything
+#
+# This forks, so it must be called while the process has a single thread.
+# Throws std::runtime_error if the workers cannot be started, or if they
+# all exit before the census is done.
+*/
+template <typename Callback, typename MergeCallback>
+void shard(TriangulationSet& census, unsigned workers, const WalkPool::Walker& walker, int walks, size_t stopAt, Callback&& onResult, MergeCallback&& onMerge) {
+	struct Worker {
+		pid_t pid;
+		int in; // lines from the worker, or -1 once it has exited
+		int out; // echoes to the worker, non-blocking
+		std::string received; // partial line from the worker
+		std::string pending; // echoes not yet written
+	};
+	std::vector<Worker> ws;
+
+	// a worker that dies must not take the reducer with it
+	signal(SIGPIPE, SIG_IGN);
+	std::cout.flush();
+	std::cerr.flush();
+	for (unsigned w = 0; w < workers; ++w) {
+		int up[2], down[2];
+		if (pipe(up) != 0 || pipe(down) != 0)
+			throw std::runtime_error(std::string("Could not create pipes: ") + std::strerror(errno));
+		pid_t pid = fork();
+		if (pid < 0)
+			throw std::runtime_error(std::string("Could not start worker: ") + std::strerror(errno));
+		if (pid == 0) {
+			for (const Worker& o : ws) {
+				close(o.in);
+				close(o.out);
+			}
+			close(up[0]);
+			close(down[1]);
+			// every worker draws from its own stream, as a thread would
+			seedWalks(walkSeed, w);
+			int status = 0;
+			try {
+				shardWorker(census, w, workers, down[0], up[1], walker, walks, onResult);
+			} catch (const std::exception& e) {
+				std::cerr << "Worker " << w << ": " << e.what() << std::endl;
+				status = 1;
+			}
+			std::cout.flush();
+			// skip destructors: they belong to the reducer
+			_exit(status);
+		}
+		close(up[1]);
+		close(down[0]);
+		fcntl(down[1], F_SETFL, O_NONBLOCK);
+		ws.push_back({ pid, up[0], down[1] });
+	}
+
+	auto retire = [](Worker& w) {
+		close(w.in);
+		if (w.out >= 0)
+			close(w.out);
+		w.in = w.out = -1;
+		w.pending.clear();
+		int status;
+		waitpid(w.pid, &status, 0);
+		if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			std::cerr << "Worker " << w.pid << " failed." << std::endl;
+	};
+
+	size_t alive = workers;
+	bool stopping = false;
+	std::vector<pollfd> fds;
+	std::vector<int> inPoll(workers), outPoll(workers); // positions in fds, or -1
+	char buf[65536];
+	while (alive > 0) {
+		if (! stopping && census.countComponents() <= stopAt) {
+			stopping = true;
+			for (Worker& w : ws)
+				if (w.out >= 0)
+					w.pending += "stop\n";
+		}
+
+		fds.clear();
+		for (unsigned w = 0; w < ws.size(); ++w) {
+			inPoll[w] = outPoll[w] = -1;
+			if (ws[w].in < 0)
+				continue;
+			inPoll[w] = fds.size();
+			fds.push_back({ ws[w].in, POLLIN, 0 });
+			if (ws[w].out >= 0 && ! ws[w].pending.empty()) {
+				outPoll[w] = fds.size();
+				fds.push_back({ ws[w].out, POLLOUT, 0 });
+			}
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("Could not wait for workers: ") + std::strerror(errno));
+		}
+
+		for (unsigned w = 0; w < ws.size(); ++w) {
+			Worker& wk = ws[w];
+			if (outPoll[w] >= 0 && wk.out >= 0 && fds[outPoll[w]].revents) {
+				ssize_t n = write(wk.out, wk.pending.data(), wk.pending.size());
+				if (n > 0)
+					wk.pending.erase(0, n);
+				else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+					close(wk.out);
+					wk.out = -1;
+					wk.pending.clear();
+				}
+			}
+			if (inPoll[w] < 0 || ! fds[inPoll[w]].revents)
+				continue;
+
+			ssize_t n = read(wk.in, buf, sizeof(buf));
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (n <= 0) {
+				retire(wk);
+				--alive;
+				continue;
+			}
+			wk.received.append(buf, n);
+			size_t eol;
+			while ((eol = wk.received.find('\n')) != std::string::npos) {
+				std::string line = wk.received.substr(0, eol);
+				wk.received.erase(0, eol + 1);
+				bool res = applyWalk(census, line);
+				// once stopping, walks still in flight are applied here
+				// but no longer echoed
+				if (! stopping) {
+					std::string echo = std::to_string(w) + ' ' + line + '\n';
+					for (Worker& o : ws)
+						if (o.out >= 0)
+							o.pending += echo;
+				}
+				if (res)
+					onMerge();
+			}
+		}
+		if (alive == 0 && ! stopping)
+			throw std::runtime_error("All workers exited before the census was done.");
+	}
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+/**
+ * Low-overhead instrumentation for the hot paths of the classification.
+ *
+ * Code records events through the STATS_* macros below.  Each thread
+ * counts into its own thread-local block, and dump() adds up the blocks of
+ * all threads, past and present.  Building with -DNO_STATS turns every
+ * macro into a no-op, so that production builds pay nothing at all.
+ *
+ * Timers cost two reads of the clock each, which is far more than a
+ * counter, so STATS_TIME does nothing until setTiming(true) is called
+ * (main.cc does so for --stats).
+ */
+
+#ifdef NO_STATS
+
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_TIME(timer) ((void)0)
+#define STATS_WALK(length) ((void)0)
+#define STATS_ATTEMPT(budget, found) ((void)0)
+
+#else
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum StatCounter {
+    statPerformCalls, // calls to perform()
+    statPerformFailed, // calls to perform() that found no legal move
+
+    // Moves tried and accepted, in the order of MoveIndex::Move:
+    statTried,
+    statAccepted = statTried + 6,
+
+    statWalks = statAccepted + 6, // calls to step()
+    statWalksFound, // calls to step() that reached the target
+    statWalkMoves, // moves made by step(), in total
+    statIsoSigs, // isosigs computed
+    statMerges, // merge attempts
+    statMergesJoined, // merge attempts that joined two components
+    statRestarts, // walks started again after running out of budget
+    statWalksGaveUp, // walks abandoned after too many restarts
+    statBeams, // calls to beam()
+    statBeamsFound, // calls to beam() that reached the target
+    statBeamStates, // states expanded by beam()
+    nStatCounters
+};
+
+enum StatTimer {
+    statTimeRefresh, // skeletons and move indices
+    statTimeMove, // checking and performing moves
+    statTimeIsoSig, // isosigs
+    statTimeMerge, // union-find merges
+    statTimeWalk, // whole calls to step()
+    statTimeBeam, // whole calls to beam()
+    nStatTimers
+};
+
+// Heavyweight class, do not copy!
+class Stats {
+    public:
+        static constexpr int nBuckets = 32; // walk lengths and budgets, by powers of two
+
+    private:
+        // Counts for a single thread.  Only the owning thread writes, but
+        // dump() may read from any thread, hence the relaxed atomics.
+        struct Block {
+            std::atomic<uint64_t> counters[nStatCounters] {};
+            std::atomic<uint64_t> nanos[nStatTimers] {};
+            std::atomic<uint64_t> walks[nBuckets] {};
+            std::atomic<uint64_t> attempts[nBuckets] {};
+            std::atomic<uint64_t> found[nBuckets] {};
+
+            void add(std::atomic<uint64_t>& v, uint64_t n) {
+                v.store(v.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+            }
+        };
+
+        // A thread's block, which hands its counts over to retired() when
+        // the thread exits.
+        struct Local {
+            Block block;
+
+            Local() {
+                std::lock_guard<std::mutex> lock(mutex());
+                live().push_back(&block);
+            }
+
+            ~Local() {
+                std::lock_guard<std::mutex> lock(mutex());
+                Block& r = retired();
+                for (int i = 0; i < nStatCounters; ++i)
+                    r.add(r.counters[i], block.counters[i]);
+                for (int i = 0; i < nStatTimers; ++i)
+                    r.add(r.nanos[i], block.nanos[i]);
+                for (int i = 0; i < nBuckets; ++i) {
+                    r.add(r.walks[i], block.walks[i]);
+                    r.add(r.attempts[i], block.attempts[i]);
+                    r.add(r.found[i], block.found[i]);
+                }
+                auto& l = live();
+                for (auto it = l.begin(); it != l.end(); ++it)
+                    if (*it == &block) {
+                        l.erase(it);
+                        break;
+                    }
+            }
+        };
+
+        static bool& timing() {
+            static bool on = false;
+            return on;
+        }
+
+        static std::mutex& mutex() {
+            static std::mutex m;
+            return m;
+        }
+
+        static std::vector<Block*>& live() {
+            static std::vector<Block*> l;
+            return l;
+        }
+
+        static Block& retired() {
+            static Block b;
+            return b;
+        }
+
+        static Block& local() {
+            thread_local Local l;
+            return l.block;
+        }
+
+        static int bucket(uint64_t n) {
+            int ans = 0;
+            while (ans + 1 < nBuckets && (uint64_t(2) << ans) <= n)
+                ++ans;
+            return ans;
+        }
+
+        static std::string range(int bucket) {
+            return std::to_string(bucket ? uint64_t(1) << bucket : 0) + "_to_" +
+                std::to_string((uint64_t(2) << bucket) - 1);
+        }
+
+    public:
+        /**
+         * A snapshot of the counts of all threads.
+         */
+        struct Totals {
+            uint64_t counters[nStatCounters] {};
+            uint64_t nanos[nStatTimers] {};
+            uint64_t walks[nBuckets] {};
+            uint64_t attempts[nBuckets] {};
+            uint64_t found[nBuckets] {};
+        };
+
+        /**
+         * Switches the timers behind STATS_TIME on or off.  This should be
+         * called before any other threads start.
+         */
+        static void setTiming(bool on) {
+            timing() = on;
+        }
+
+        static void count(StatCounter c, uint64_t n = 1) {
+            Block& b = local();
+            b.add(b.counters[c], n);
+        }
+
+        static void time(StatTimer t, uint64_t nanos) {
+            Block& b = local();
+            b.add(b.nanos[t], nanos);
+        }
+
+        /**
+         * Records a walk of the given number of moves.
+         */
+        static void walk(uint64_t length) {
+            Block& b = local();
+            b.add(b.walks[bucket(length)], 1);
+            b.add(b.counters[statWalkMoves], length);
+        }
+
+        /**
+         * Records an attempt at a walk with the given budget of moves, and
+         * whether it reached its target within that budget.
+         */
+        static void attempt(uint64_t budget, bool success) {
+            Block& b = local();
+            b.add(b.attempts[bucket(budget)], 1);
+            if (success)
+                b.add(b.found[bucket(budget)], 1);
+        }
+
+        /**
+         * Adds up the counts of all threads so far.
+         */
+        static Totals totals() {
+            Totals ans;
+            std::lock_guard<std::mutex> lock(mutex());
+            std::vector<Block*> blocks = live();
+            blocks.push_back(&retired());
+            for (const Block* b : blocks) {
+                for (int i = 0; i < nStatCounters; ++i)
+                    ans.counters[i] += b->counters[i].load(std::memory_order_relaxed);
+                for (int i = 0; i < nStatTimers; ++i)
+                    ans.nanos[i] += b->nanos[i].load(std::memory_order_relaxed);
+                for (int i = 0; i < nBuckets; ++i) {
+                    ans.walks[i] += b->walks[i].load(std::memory_order_relaxed);
+                    ans.attempts[i] += b->attempts[i].load(std::memory_order_relaxed);
+                    ans.found[i] += b->found[i].load(std::memory_order_relaxed);
+                }
+            }
+            return ans;
+        }
+
+        /**
+         * Writes the counts accumulated since the given snapshot as CSV
+         * rows of the form phase,metric,value, and then updates the
+         * snapshot.  Zero counts are left out.
+         */
+        static void dump(std::ostream& out, const std::string& phase,
+                Totals& since) {
+            static const char* counterNames[nStatCounters] = {
+                "perform_calls", "perform_failed",
+                "tried_collapse", "tried_3-3", "tried_2-0_edge",
+                "tried_2-0_triangle", "tried_2-4", "tried_1-5",
+                "accepted_collapse", "accepted_3-3", "accepted_2-0_edge",
+                "accepted_2-0_triangle", "accepted_2-4", "accepted_1-5",
+                "walks", "walks_found", "walk_moves", "isosigs",
+                "merges", "merges_joined", "restarts", "walks_gave_up",
+                "beams", "beams_found", "beam_states"
+            };
+            static const char* timerNames[nStatTimers] = {
+                "seconds_refresh", "seconds_move", "seconds_isosig",
+                "seconds_merge", "seconds_walk", "seconds_beam"
+            };
+
+            Totals now = totals();
+            for (int i = 0; i < nStatCounters; ++i)
+                if (now.counters[i] != since.counters[i])
+                    out << phase << ',' << counterNames[i] << ',' <<
+                        (now.counters[i] - since.counters[i]) << '\n';
+            for (int i = 0; i < nStatTimers; ++i)
+                if (now.nanos[i] != since.nanos[i])
+                    out << phase << ',' << timerNames[i] << ',' <<
+                        (now.nanos[i] - since.nanos[i]) * 1e-9 << '\n';
+            for (int i = 0; i < nBuckets; ++i)
+                if (now.walks[i] != since.walks[i])
+                    out << phase << ",walks_of_length_" << range(i) << ',' <<
+                        (now.walks[i] - since.walks[i]) << '\n';
+            // Success rate against budget:
+            for (int i = 0; i < nBuckets; ++i)
+                if (now.attempts[i] != since.attempts[i])
+                    out << phase << ",budget_" << range(i) << "_attempts," <<
+                        (now.attempts[i] - since.attempts[i]) << '\n' <<
+                        phase << ",budget_" << range(i) << "_found," <<
+                        (now.found[i] - since.found[i]) << '\n';
+            out.flush();
+            since = now;
+        }
+
+        /**
+         * Adds the time from construction to destruction to the given timer,
+         * if timing was switched on at construction.  Otherwise the clock is
+         * never read.
+         */
+        class Scope {
+            private:
+                StatTimer timer_;
+                bool on_;
+                std::chrono::steady_clock::time_point start_;
+
+            public:
+                Scope(StatTimer timer) : timer_(timer), on_(timing()) {
+                    if (on_)
+                        start_ = std::chrono::steady_clock::now();
+                }
+
+                ~Scope() {
+                    if (on_)
+                        Stats::time(timer_, std::chrono::duration_cast<
+                            std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start_).count());
+                }
+
+                Scope(const Scope&) = delete;
+                Scope& operator = (const Scope&) = delete;
+        };
+};
+
+#define STATS_CONCAT2(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT2(a, b)
+
+#define STATS_COUNT(counter) Stats::count(counter)
+#define STATS_ADD(counter, n) Stats::count(counter, n)
+#define STATS_TIME(timer) Stats::Scope STATS_CONCAT(statsScope, __LINE__)(timer)
+#define STATS_WALK(length) Stats::walk(length)
+#define STATS_ATTEMPT(budget, found) Stats::attempt(budget, found)
+
+#endif
@@ -0,0 +1,1057 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "stats.h"
+#include "triangulation/dim4.h"
+#include "triangulation/isosigtype.h"
+#include "triangulation/detail/isosig-impl.h"
+#ifdef TRI4_VERIFY
+#include <cstdlib>
+#include <iostream>
+#endif
+
+/**
+ * Numbering of the faces of a single pentachoron, as used by Tri4.
+ *
+ * A face is described by the bitmask of its vertices.  Within each
+ * dimension, faces are numbered in lexicographical order of their vertex
+ * sets, except that tetrahedron i is the facet opposite vertex i.
+ */
+struct Tri4Faces {
+    uint8_t count[5] { 5, 10, 10, 5, 1 }; // faces of each dimension
+    uint8_t mask[4][10] {}; // vertex mask of each face
+    int8_t index[32] {}; // number of the face with the given vertex mask
+
+    constexpr Tri4Faces() {
+        int next[5] {};
+        for (int a = 0; a < 5; ++a)
+            for (int b = a + 1; b < 5; ++b)
+                for (int c = b + 1; c < 5; ++c)
+                    add(2, next, (1 << a) | (1 << b) | (1 << c));
+        for (int a = 0; a < 5; ++a)
+            for (int b = a + 1; b < 5; ++b)
+                add(1, next, (1 << a) | (1 << b));
+        for (int a = 0; a < 5; ++a) {
+            add(0, next, 1 << a);
+            mask[3][a] = 31 & ~(1 << a);
+            index[31 & ~(1 << a)] = a;
+        }
+        index[31] = 0;
+    }
+
+    static constexpr int dim(unsigned m) {
+        int ans = -1;
+        for ( ; m; m &= m - 1)
+            ++ans;
+        return ans;
+    }
+
+    private:
+        constexpr void add(int d, int* next, int m) {
+            mask[d][next[d]] = m;
+            index[m] = next[d]++;
+        }
+};
+
+inline constexpr Tri4Faces tri4Faces {};
+
+/**
+ * A compact 4-manifold triangulation for the inner loop of the random walk.
+ *
+ * Gluings are kept in two flat arrays indexed by 5 * pentachoron + facet.
+ * The skeleton (vertices, edges, triangles and tetrahedra, with their
+ * degrees and embeddings) is only computed when somebody asks for it, and
+ * Pachner moves, edge collapses and 2-0 moves are carried out in place by
+ * rewriting the affected gluings.  Conversion to regina is only needed to
+ * compute isosigs, and for collapses and 2-0 moves on triangulations with
+ * boundary (see MoveIndex).
+ *
+ * Pentachoron indices are not preserved by moves; changed() lists the
+ * pentachora whose gluings have changed since the last clearChanges().
+ *
+ * Changes can be journaled and rolled back in place (see mark() and
+ * undo()), so that a search can try a move and take it back without
+ * copying the triangulation.
+ *
+ * If TRI4_VERIFY is defined, every move is replayed through regina and the
+ * two results are compared by edge-degree isosig.
+ */
+class Tri4 {
+    public:
+        /**
+         * A single appearance of a face within a pentachoron.
+         */
+        struct Embedding {
+            int32_t pent;
+            uint8_t face; // face number within the pentachoron, as in Tri4Faces
+        };
+
+    private:
+        std::vector<int32_t> adj_; // adjacent pentachoron, or -1 for boundary
+        std::vector<regina::Perm<5>> gluing_; // gluing permutation
+
+        // Pentachora whose gluings changed since the last clearChanges():
+        std::vector<int32_t> changed_;
+        bool changedAll_ { true };
+
+        // Undo journal: the old contents of each facet slot overwritten
+        // since journaling began, in order of writing.  An entry with slot
+        // noSlot records the old number of pentachora instead.
+        struct Change {
+            uint32_t slot;
+            int32_t adj;
+            regina::Perm<5> gluing;
+        };
+        static constexpr uint32_t noSlot = uint32_t(-1);
+        std::vector<Change> journal_;
+        bool journaling_ { false };
+
+        // Skeleton, computed on demand:
+        mutable bool skeleton_ { false };
+        mutable std::vector<int32_t> faceOf_[4]; // face containing each (pent, local face)
+        mutable std::vector<int32_t> embStart_[4]; // CSR offsets into emb_ per face
+        mutable std::vector<Embedding> emb_[4]; // embeddings grouped by face
+        mutable std::vector<int32_t> uf_; // scratch space for union-find
+
+        // Scratch space for collapses and 2-0 moves (see flatten()):
+        struct Pair {
+            int32_t key; // the face that identifies a and b
+            int32_t a, b;
+        };
+        struct Flat {
+            uint32_t slot; // facet slot to be identified
+            uint32_t partner; // facet slot it is identified with
+            regina::Perm<5> map; // vertices of slot's pentachoron to partner's
+        };
+        struct Join {
+            int32_t pent;
+            int facet;
+            int32_t adj;
+            regina::Perm<5> gluing;
+        };
+        std::vector<Pair> pairs_;
+        std::vector<int32_t> pents_;
+        std::vector<Flat> flats_;
+        std::vector<Join> joins_;
+        std::vector<char> visited_;
+
+    public:
+        Tri4() = default;
+
+        /**
+         * Copies the gluings of the given regina triangulation.
+         * Pentachoron and vertex numbering are preserved.
+         */
+        explicit Tri4(const regina::Triangulation<4>& tri) :
+                adj_(5 * tri.size()), gluing_(5 * tri.size()) {
+            for (size_t p = 0; p < tri.size(); ++p) {
+                auto* pent = tri.pentachoron(p);
+                for (int f = 0; f < 5; ++f) {
+                    auto* q = pent->adjacentSimplex(f);
+                    adj_[5 * p + f] = (q ? int32_t(q->index()) : -1);
+                    if (q)
+                        gluing_[5 * p + f] = pent->adjacentGluing(f);
+                }
+            }
+        }
+
+        /**
+         * Builds the corresponding regina triangulation, preserving
+         * pentachoron and vertex numbering.
+         */
+        regina::Triangulation<4> toRegina() const {
+            regina::Triangulation<4> ans;
+            for (size_t p = 0; p < size(); ++p)
+                ans.newSimplex();
+            for (size_t p = 0; p < size(); ++p)
+                for (int f = 0; f < 5; ++f) {
+                    int32_t q = adj_[5 * p + f];
+                    if (q < 0)
+                        continue;
+                    int g = gluing_[5 * p + f][f];
+                    // Join each pair of facets once only.
+                    if (size_t(q) > p || (size_t(q) == p && g > f))
+                        ans.pentachoron(p)->join(f, ans.pentachoron(q),
+                            gluing_[5 * p + f]);
+                }
+            return ans;
+        }
+
+        /**
+         * Returns the edge-degree isosig for this triangulation.
+         */
+        std::string isoSig() const {
+            STATS_COUNT(statIsoSigs);
+            STATS_TIME(statTimeIsoSig);
+            return toRegina().isoSig<regina::IsoSigEdgeDegrees<4>>();
+        }
+
+        size_t size() const {
+            return adj_.size() / 5;
+        }
+
+        /**
+         * Returns the pentachoron glued to the given facet, or -1 if the
+         * facet is boundary.
+         */
+        int32_t adjacent(int32_t pent, int facet) const {
+            return adj_[5 * pent + facet];
+        }
+
+        /**
+         * Returns the gluing permutation for the given facet.
+         *
+         * PRE: The facet is not boundary.
+         */
+        regina::Perm<5> gluing(int32_t pent, int facet) const {
+            return gluing_[5 * pent + facet];
+        }
+
+        /**
+         * Returns the number of faces of the given dimension (0 to 3).
+         */
+        size_t countFaces(int dim) const {
+            skeleton();
+            return embStart_[dim].size() - 1;
+        }
+
+        size_t countVertices() const { return countFaces(0); }
+        size_t countEdges() const { return countFaces(1); }
+        size_t countTriangles() const { return countFaces(2); }
+        size_t countTetrahedra() const { return countFaces(3); }
+
+        /**
+         * Determines whether any facet is boundary.
+         */
+        bool hasBoundary() const {
+            return std::find(adj_.begin(), adj_.end(), -1) != adj_.end();
+        }
+
+        /**
+         * Returns the number of embeddings of the given face.
+         */
+        size_t degree(int dim, size_t face) const {
+            skeleton();
+            return embStart_[dim][face + 1] - embStart_[dim][face];
+        }
+
+        /**
+         * Returns the given embedding of the given face.
+         */
+        Embedding embedding(int dim, size_t face, size_t i) const {
+            skeleton();
+            return emb_[dim][embStart_[dim][face] + i];
+        }
+
+        /**
+         * Returns the face of the given dimension that appears as the given
+         * face number within the given pentachoron.
+         */
+        int32_t faceOf(int dim, int32_t pent, int face) const {
+            skeleton();
+            return faceOf_[dim][pent * tri4Faces.count[dim] + face];
+        }
+
+        /**
+         * Determines whether the embeddings of the given face all lie in
+         * distinct pentachora.
+         */
+        bool distinctPentachora(int dim, size_t face) const {
+            skeleton();
+            for (int32_t i = embStart_[dim][face]; i < embStart_[dim][face + 1]; ++i)
+                for (int32_t j = embStart_[dim][face]; j < i; ++j)
+                    if (emb_[dim][i].pent == emb_[dim][j].pent)
+                        return false;
+            return true;
+        }
+
+        /**
+         * Returns the pentachora whose gluings have changed since the last
+         * call to clearChanges().  This is only meaningful if changedAll()
+         * returns false.
+         */
+        const std::vector<int32_t>& changed() const {
+            return changed_;
+        }
+
+        /**
+         * Returns true if the entire triangulation should be treated as
+         * changed since the last call to clearChanges().
+         */
+        bool changedAll() const {
+            return changedAll_;
+        }
+
+        void clearChanges() {
+            changed_.clear();
+            changedAll_ = false;
+        }
+
+        /**
+         * Starts journaling changes to the gluings (if this has not
+         * already started), and returns a mark for the current state.
+         */
+        size_t mark() {
+            journaling_ = true;
+            return journal_.size();
+        }
+
+        /**
+         * Rolls back every change made since the given mark was taken,
+         * in place.  The pentachora involved are reported by changed() as
+         * usual, so a MoveIndex can simply be refreshed afterwards (in full,
+         * if anything other than Pachner moves was undone).
+         *
+         * PRE: mark was returned by mark(), and neither undo() to an
+         * earlier mark nor clearJournal() has been called since.
+         */
+        void undo(size_t mark) {
+            while (journal_.size() > mark) {
+                const Change& c = journal_.back();
+                if (c.slot == noSlot) {
+                    adj_.resize(5 * size_t(c.adj));
+                    gluing_.resize(adj_.size());
+                } else {
+                    adj_[c.slot] = c.adj;
+                    gluing_[c.slot] = c.gluing;
+                    changed_.push_back(c.slot / 5);
+                }
+                journal_.pop_back();
+            }
+            skeleton_ = false;
+        }
+
+        /**
+         * Stops journaling and forgets the journal.
+         */
+        void clearJournal() {
+            journaling_ = false;
+            journal_.clear();
+        }
+
+        /**
+         * Makes this a copy of the given triangulation, as if by a move:
+         * only the pentachora whose gluings differ are reported by
+         * changed(), and the change is journaled if journaling is on.
+         */
+        void assign(const Tri4& other) {
+            size_t oldSize = size();
+            if (other.size() > oldSize)
+                resize(other.size());
+            for (size_t s = 0; s < other.adj_.size(); ++s)
+                if (s >= 5 * oldSize || adj_[s] != other.adj_[s] ||
+                        (adj_[s] >= 0 && gluing_[s] != other.gluing_[s])) {
+                    write(s, other.adj_[s], other.gluing_[s]);
+                    changed_.push_back(s / 5);
+                }
+            if (other.size() < oldSize)
+                resize(other.size());
+            skeleton_ = false;
+        }
+
+        /**
+         * Checks and/or performs the Pachner move about the face with the
+         * given vertex mask in the given pentachoron.  A mask of 31 gives
+         * the 1-5 move on the pentachoron itself, a facet gives a 2-4 move
+         * and a triangle gives a 3-3 move (edges and vertices give 4-2 and
+         * 5-1 moves).
+         *
+         * The move is legal if the face is non-boundary and valid, and its
+         * star consists of the right number of distinct pentachora.  The
+         * move is always checked, since finding the star does most of the
+         * work, and it is only performed if it is legal.
+         *
+         * Returns true if the move is legal.
+         */
+        bool pachner(int32_t pent, unsigned mask, bool perform = true) {
+#ifdef TRI4_VERIFY
+            if (perform)
+                return verifiedPachner(pent, mask);
+#endif
+            return pachnerImpl(pent, mask, perform);
+        }
+
+        /**
+         * Checks and/or performs the collapse of the edge with the given
+         * vertex mask in the given pentachoron.  Every pentachoron around
+         * the edge is flattened onto a tetrahedron, and the edge becomes a
+         * single vertex.
+         *
+         * The move is legal if the two ends of the edge are distinct
+         * vertices, the pentachora around the edge are distinct, and the
+         * edges, triangles and tetrahedra that the collapse identifies in
+         * pairs form a forest in each dimension (as in regina).
+         *
+         * Returns true if the move is legal.
+         *
+         * PRE: The triangulation is valid and has no boundary.
+         */
+        bool collapseEdge(int32_t pent, unsigned mask, bool perform = true) {
+#ifdef TRI4_VERIFY
+            if (perform)
+                return verifiedFlatten(pent, mask, true);
+#endif
+            return collapseEdgeImpl(pent, mask, perform);
+        }
+
+        /**
+         * Checks and/or performs the 2-0 move about the edge or triangle
+         * with the given vertex mask in the given pentachoron.  The two
+         * pentachora around the face are removed, and the remaining facets
+         * of one are glued to those of the other.
+         *
+         * The move is legal if the face has degree 2 in distinct
+         * pentachora, the two faces opposite it are distinct, and the
+         * triangles (for a triangle) and tetrahedra that the move
+         * identifies in pairs form a forest.
+         *
+         * Returns true if the move is legal.
+         *
+         * PRE: The triangulation is valid and has no boundary.
+         */
+        bool twoZeroMove(int32_t pent, unsigned mask, bool perform = true) {
+#ifdef TRI4_VERIFY
+            if (perform)
+                return verifiedFlatten(pent, mask, false);
+#endif
+            return twoZeroImpl(pent, mask, perform);
+        }
+
+    private:
+        /**
+         * The Pachner move itself.
+         *
+         * We label the six vertices of the 5-simplex that the move "passes
+         * through": the vertices of the face get labels 0..d, and the
+         * vertices of its link get labels d+1..5.  The old pentachora are
+         * those that omit one link label, and the new pentachora are those
+         * that omit one face label.  Each new pentachoron numbers its
+         * vertices in increasing order of label.
+         */
+        bool pachnerImpl(int32_t pent, unsigned mask, bool perform) {
+            const int d = Tri4Faces::dim(mask);
+            const int nOld = 5 - d;
+            const int nNew = d + 1;
+
+            // For each old pentachoron (by slot = omitted link label - d - 1):
+            int32_t star[5];
+            int8_t lab2loc[5][6];
+            int8_t loc2lab[5][5];
+            int32_t oldAdj[5][5];
+            regina::Perm<5> oldGluing[5][5];
+            std::fill(star, star + nOld, -1);
+
+            // The first pentachoron omits label d+1.
+            {
+                int nextFace = 0, nextLink = d + 2;
+                for (int v = 0; v < 5; ++v) {
+                    int lab = ((mask >> v) & 1) ? nextFace++ : nextLink++;
+                    loc2lab[0][v] = lab;
+                    lab2loc[0][lab] = v;
+                }
+                lab2loc[0][d + 1] = -1;
+                star[0] = pent;
+            }
+
+            // Find the other pentachora in the star by walking through the
+            // facets that contain the face.
+            int queue[5], qHead = 0, qTail = 0;
+            queue[qTail++] = 0;
+            while (qHead < qTail) {
+                int s = queue[qHead++];
+                int32_t p = star[s];
+                for (int u = 0; u < 5; ++u) {
+                    int m = loc2lab[s][u];
+                    if (m <= d)
+                        continue;
+                    int32_t q = adj_[5 * p + u];
+                    if (q < 0)
+                        return false; // face is boundary
+                    regina::Perm<5> g = gluing_[5 * p + u];
+                    int t = m - d - 1;
+
+                    int8_t lab[5];
+                    for (int v = 0; v < 5; ++v)
+                        lab[g[v]] = (v == u ? s + d + 1 : loc2lab[s][v]);
+
+                    if (star[t] < 0) {
+                        for (int i = 0; i < nOld; ++i)
+                            if (star[i] == q)
+                                return false; // pentachora not distinct
+                        star[t] = q;
+                        for (int v = 0; v < 5; ++v) {
+                            loc2lab[t][v] = lab[v];
+                            lab2loc[t][int(lab[v])] = v;
+                        }
+                        lab2loc[t][t + d + 1] = -1;
+                        queue[qTail++] = t;
+                    } else {
+                        if (star[t] != q)
+                            return false; // star is not a ball
+                        for (int v = 0; v < 5; ++v)
+                            if (loc2lab[t][v] != lab[v])
+                                return false; // face is invalid
+                    }
+                }
+            }
+            for (int s = 0; s < nOld; ++s)
+                if (star[s] < 0)
+                    return false; // wrong degree
+
+            if (! perform)
+                return true;
+
+            // Save the old gluings before we overwrite anything.
+            for (int s = 0; s < nOld; ++s)
+                for (int f = 0; f < 5; ++f) {
+                    oldAdj[s][f] = adj_[5 * star[s] + f];
+                    oldGluing[s][f] = gluing_[5 * star[s] + f];
+                }
+
+            // Choose where the new pentachora live: reuse the old slots
+            // first, then append.
+            int32_t slot[6];
+            for (int i = 0; i < nNew; ++i)
+                slot[i] = (i < nOld ? star[i] : int32_t(size()) + (i - nOld));
+            if (nNew > nOld)
+                resize(size() + nNew - nOld);
+
+            auto newLab2Loc = [](int i, int x) { return x < i ? x : x - 1; };
+            auto newLoc2Lab = [](int i, int v) { return v < i ? v : v + 1; };
+
+            for (int i = 0; i < nNew; ++i) {
+                // Gluings between new pentachora i and j share every label
+                // except i and j.
+                for (int j = 0; j < nNew; ++j) {
+                    if (j == i)
+                        continue;
+                    int img[5];
+                    for (int v = 0; v < 5; ++v) {
+                        int x = newLoc2Lab(i, v);
+                        img[v] = newLab2Loc(j, x == j ? i : x);
+                    }
+                    set(slot[i], newLab2Loc(i, j), slot[j], img);
+                }
+
+                // Gluings to the outside of the star, through the facet of
+                // old pentachoron s that omits face label i.
+                for (int s = 0; s < nOld; ++s) {
+                    int l = s + d + 1;
+                    int fOld = lab2loc[s][i];
+                    int fNew = newLab2Loc(i, l);
+                    int32_t r = oldAdj[s][fOld];
+                    if (r < 0) {
+                        write(5 * slot[i] + fNew, -1, regina::Perm<5>());
+                        continue;
+                    }
+                    regina::Perm<5> g = oldGluing[s][fOld];
+
+                    // Where does each vertex of the new pentachoron land in
+                    // the old one, and then in r?
+                    int img[5];
+                    for (int v = 0; v < 5; ++v) {
+                        int x = newLoc2Lab(i, v);
+                        img[v] = g[lab2loc[s][x == l ? i : x]];
+                    }
+
+                    int m = -1;
+                    for (int t = 0; t < nOld; ++t)
+                        if (star[t] == r)
+                            m = t;
+                    if (m < 0) {
+                        // r lies outside the star.
+                        set(slot[i], fNew, r, img);
+                        setInverse(slot[i], fNew);
+                    } else {
+                        // The star is glued to itself; translate labels of
+                        // old pentachoron m into new pentachoron i2.
+                        int i2 = loc2lab[m][g[fOld]];
+                        int lm = m + d + 1;
+                        for (int v = 0; v < 5; ++v) {
+                            int y = loc2lab[m][img[v]];
+                            img[v] = newLab2Loc(i2, y == i2 ? lm : y);
+                        }
+                        set(slot[i], fNew, slot[i2], img);
+                    }
+                }
+            }
+
+            for (int i = 0; i < nNew; ++i)
+                changed_.push_back(slot[i]);
+
+            // Remove any old pentachora that were not reused, by moving the
+            // last pentachora into their slots.
+            if (nOld > nNew) {
+                int32_t holes[5];
+                int nHoles = 0;
+                for (int s = nNew; s < nOld; ++s)
+                    holes[nHoles++] = star[s];
+                std::sort(holes, holes + nHoles);
+                for (int h = nHoles - 1; h >= 0; --h)
+                    remove(holes[h]);
+            }
+
+            skeleton_ = false;
+            return true;
+        }
+
+        /**
+         * Sets the gluing for the given facet (in one direction only).
+         */
+        void set(int32_t pent, int facet, int32_t adj, const int* img) {
+            write(5 * pent + facet, adj,
+                regina::Perm<5>(img[0], img[1], img[2], img[3], img[4]));
+        }
+
+        /**
+         * Makes the other side of the given facet point back to it.
+         */
+        void setInverse(int32_t pent, int facet) {
+            int32_t q = adj_[5 * pent + facet];
+            regina::Perm<5> g = gluing_[5 * pent + facet];
+            write(5 * q + g[facet], pent, g.inverse());
+            changed_.push_back(q);
+        }
+
+        /**
+         * Overwrites the given facet slot (5 * pentachoron + facet),
+         * journaling its old contents if need be.
+         */
+        void write(size_t slot, int32_t adj, regina::Perm<5> gluing) {
+            if (journaling_)
+                journal_.push_back({ uint32_t(slot), adj_[slot], gluing_[slot] });
+            adj_[slot] = adj;
+            gluing_[slot] = gluing;
+        }
+
+        /**
+         * Changes the number of pentachora, journaling the old size (and
+         * the contents of any slots that are cut off) if need be.
+         */
+        void resize(size_t pents) {
+            if (journaling_) {
+                for (size_t s = 5 * pents; s < adj_.size(); ++s)
+                    journal_.push_back({ uint32_t(s), adj_[s], gluing_[s] });
+                journal_.push_back({ noSlot, int32_t(size()), regina::Perm<5>() });
+            }
+            adj_.resize(5 * pents);
+            gluing_.resize(adj_.size());
+        }
+
+        /**
+         * Deletes the given pentachoron, whose facets must no longer be
+         * referred to by anybody, and moves the last pentachoron into its
+         * place.
+         */
+        void remove(int32_t pent) {
+            int32_t last = int32_t(size()) - 1;
+            if (pent != last) {
+                for (int f = 0; f < 5; ++f) {
+                    int32_t q = adj_[5 * last + f];
+                    regina::Perm<5> g = gluing_[5 * last + f];
+                    write(5 * pent + f, (q == last ? pent : q), g);
+                    if (q >= 0 && q != last)
+                        write(5 * q + g[f], pent, gluing_[5 * q + g[f]]);
+                    if (q >= 0)
+                        changed_.push_back(q == last ? pent : q);
+                }
+                changed_.push_back(pent);
+            }
+            resize(last);
+            // Forget about the old index of the last pentachoron.
+            changed_.erase(std::remove(changed_.begin(), changed_.end(), last),
+                changed_.end());
+        }
+
+        /**
+         * Computes the skeleton, if it is not already known.
+         */
+        void skeleton() const {
+            if (skeleton_)
+                return;
+            const int32_t n = int32_t(size());
+
+            for (int dim = 0; dim < 4; ++dim) {
+                const int nf = tri4Faces.count[dim];
+                uf_.resize(n * nf);
+                for (int32_t i = 0; i < n * nf; ++i)
+                    uf_[i] = i;
+
+                for (int32_t p = 0; p < n; ++p)
+                    for (int f = 0; f < 5; ++f) {
+                        int32_t q = adj_[5 * p + f];
+                        if (q < 0)
+                            continue;
+                        regina::Perm<5> g = gluing_[5 * p + f];
+                        for (int i = 0; i < nf; ++i) {
+                            unsigned m = tri4Faces.mask[dim][i];
+                            if (m & (1 << f))
+                                continue;
+                            unsigned img = 0;
+                            for (int v = 0; v < 5; ++v)
+                                if (m & (1 << v))
+                                    img |= (1 << g[v]);
+                            unite(p * nf + i, q * nf + tri4Faces.index[img]);
+                        }
+                    }
+
+                // Number the faces in order of first appearance.
+                auto& faceOf = faceOf_[dim];
+                auto& start = embStart_[dim];
+                faceOf.assign(n * nf, -1);
+                start.clear();
+                int32_t nFaces = 0;
+                for (int32_t i = 0; i < n * nf; ++i) {
+                    int32_t r = find(i);
+                    if (faceOf[r] < 0) {
+                        faceOf[r] = nFaces++;
+                        start.push_back(0);
+                    }
+                    faceOf[i] = faceOf[r];
+                    ++start[faceOf[i]];
+                }
+
+                // Turn degrees into offsets, and group the embeddings.
+                int32_t total = 0;
+                for (auto& s : start) {
+                    int32_t deg = s;
+                    s = total;
+                    total += deg;
+                }
+                start.push_back(total);
+                emb_[dim].resize(total);
+                std::vector<int32_t> fill(start.begin(), start.end() - 1);
+                for (int32_t i = 0; i < n * nf; ++i)
+                    emb_[dim][fill[faceOf[i]]++] = { i / nf, uint8_t(i % nf) };
+            }
+            skeleton_ = true;
+        }
+
+        /**
+         * Collapses the given edge (see collapseEdge()).
+         */
+        bool collapseEdgeImpl(int32_t pent, unsigned mask, bool perform) {
+            int32_t e = faceOf(1, pent, tri4Faces.index[mask]);
+            auto ends = localVertices(mask);
+            if (faceOf(0, pent, ends[0]) == faceOf(0, pent, ends[1]) ||
+                    ! distinctPentachora(1, e))
+                return false;
+
+            // Each triangle (tetrahedron) around the edge identifies the two
+            // edges (triangles) that join its other vertices to the two ends.
+            for (int dim = 1; dim <= 2; ++dim) {
+                pairs_.clear();
+                for (size_t j = 0; j < degree(1, e); ++j) {
+                    auto emb = embedding(1, e, j);
+                    unsigned m = tri4Faces.mask[1][emb.face];
+                    auto v = localVertices(m);
+                    for (unsigned rest = 1; rest < 32; ++rest) {
+                        if ((rest & m) || Tri4Faces::dim(rest) != dim - 1)
+                            continue;
+                        pairs_.push_back({
+                            faceOf(dim + 1, emb.pent, tri4Faces.index[m | rest]),
+                            faceOf(dim, emb.pent, tri4Faces.index[(1 << v[0]) | rest]),
+                            faceOf(dim, emb.pent, tri4Faces.index[(1 << v[1]) | rest]) });
+                    }
+                }
+                if (! forest(countFaces(dim)))
+                    return false;
+            }
+
+            // Each pentachoron around the edge identifies its two facets
+            // opposite the ends, which is checked by flatten().
+            pents_.clear();
+            flats_.clear();
+            for (size_t j = 0; j < degree(1, e); ++j) {
+                auto emb = embedding(1, e, j);
+                auto v = localVertices(tri4Faces.mask[1][emb.face]);
+                regina::Perm<5> swap(v[0], v[1]);
+                pents_.push_back(emb.pent);
+                flats_.push_back({ uint32_t(5 * emb.pent + v[0]), uint32_t(5 * emb.pent + v[1]), swap });
+                flats_.push_back({ uint32_t(5 * emb.pent + v[1]), uint32_t(5 * emb.pent + v[0]), swap });
+            }
+            return flatten(perform);
+        }
+
+        /**
+         * Makes the 2-0 move about the given edge or triangle (see
+         * twoZeroMove()).
+         */
+        bool twoZeroImpl(int32_t pent, unsigned mask, bool perform) {
+            const int d = Tri4Faces::dim(mask);
+            int32_t face = faceOf(d, pent, tri4Faces.index[mask]);
+            if (degree(d, face) != 2 || ! distinctPentachora(d, face))
+                return false;
+            auto emb = embedding(d, face, 0);
+            const int32_t p = emb.pent;
+            const int32_t q = embedding(d, face, 1).pent;
+            const unsigned m = tri4Faces.mask[d][emb.face];
+
+            // Every facet of p that contains the face must be glued to q,
+            // all by the same gluing.
+            regina::Perm<5> g;
+            bool first = true;
+            for (int u = 0; u < 5; ++u) {
+                if (m & (1 << u))
+                    continue;
+                if (adj_[5 * p + u] != q ||
+                        (! first && gluing_[5 * p + u] != g))
+                    return false;
+                g = gluing_[5 * p + u];
+                first = false;
+            }
+
+            // The faces of p and q opposite the face must be distinct, and
+            // for a triangle, the three pairs of triangles that join these
+            // to each vertex of the triangle must form a forest.
+            auto image = [&](unsigned s) {
+                unsigned ans = 0;
+                for (int v = 0; v < 5; ++v)
+                    if (s & (1 << v))
+                        ans |= (1 << g[v]);
+                return ans;
+            };
+            const unsigned opp = 31 & ~m;
+            const int od = Tri4Faces::dim(opp);
+            if (faceOf(od, p, tri4Faces.index[opp]) ==
+                    faceOf(od, q, tri4Faces.index[image(opp)]))
+                return false;
+            if (d == 2) {
+                pairs_.clear();
+                for (int u = 0; u < 5; ++u)
+                    if (m & (1 << u))
+                        pairs_.push_back({ u,
+                            faceOf(2, p, tri4Faces.index[opp | (1 << u)]),
+                            faceOf(2, q, tri4Faces.index[image(opp | (1 << u))]) });
+                if (! forest(countFaces(2)))
+                    return false;
+            }
+
+            // The remaining facets of p are identified with those of q.
+            pents_.assign({ p, q });
+            flats_.clear();
+            for (int u = 0; u < 5; ++u)
+                if (m & (1 << u)) {
+                    flats_.push_back({ uint32_t(5 * p + u), uint32_t(5 * q + g[u]), g });
+                    flats_.push_back({ uint32_t(5 * q + g[u]), uint32_t(5 * p + u), g.inverse() });
+                }
+            return flatten(perform);
+        }
+
+        /**
+         * Checks and/or carries out a move that removes the pentachora in
+         * pents_ and identifies their facets in pairs, as listed in flats_.
+         * Everything else in these pentachora must be glued among
+         * themselves.
+         *
+         * The identified facets form chains, each of which runs from a
+         * facet outside the pentachora, through flat pairs and the gluings
+         * between them, to another facet outside; these two outside facets
+         * are then glued to each other.  The move is illegal if any chain
+         * is closed, since it would then identify a tetrahedron with itself.
+         *
+         * Returns true if the move is legal.
+         */
+        bool flatten(bool perform) {
+            std::sort(flats_.begin(), flats_.end(),
+                [](const Flat& a, const Flat& b) { return a.slot < b.slot; });
+            std::sort(pents_.begin(), pents_.end());
+            visited_.assign(flats_.size(), false);
+            joins_.clear();
+
+            for (size_t i = 0; i < flats_.size(); ++i) {
+                if (visited_[i])
+                    continue;
+                // Only start from a flat facet whose outside is not flat.
+                int32_t x = adj_[flats_[i].slot];
+                if (x < 0)
+                    return false;
+                regina::Perm<5> m = gluing_[flats_[i].slot];
+                int xf = m[flats_[i].slot % 5];
+                if (flat(5 * x + xf) >= 0)
+                    continue;
+
+                // m takes the vertices of x to those of the current
+                // pentachoron of the chain.
+                m = m.inverse();
+                for (size_t j = i; ; ) {
+                    const Flat& f = flats_[j];
+                    visited_[j] = true;
+                    visited_[flat(f.partner)] = true;
+                    int32_t y = adj_[f.partner];
+                    if (y < 0)
+                        return false;
+                    m = gluing_[f.partner] * f.map * m;
+                    int yf = m[xf];
+                    long next = flat(5 * y + yf);
+                    if (next < 0) {
+                        if (std::binary_search(pents_.begin(), pents_.end(), y))
+                            return false; // the pentachora are not glued up as promised
+                        joins_.push_back({ x, xf, y, m });
+                        break;
+                    }
+                    j = next;
+                }
+            }
+            if (std::find(visited_.begin(), visited_.end(), false) != visited_.end())
+                return false; // closed chain
+
+            if (! perform)
+                return true;
+
+            for (const Join& j : joins_) {
+                write(5 * j.pent + j.facet, j.adj, j.gluing);
+                write(5 * j.adj + j.gluing[j.facet], j.pent, j.gluing.inverse());
+                changed_.push_back(j.pent);
+                changed_.push_back(j.adj);
+            }
+            for (size_t i = pents_.size(); i > 0; --i)
+                remove(pents_[i - 1]);
+
+            skeleton_ = false;
+            return true;
+        }
+
+        /**
+         * Returns the position of the given facet slot in flats_, or -1 if
+         * it is not there.
+         */
+        long flat(uint32_t slot) const {
+            auto it = std::lower_bound(flats_.begin(), flats_.end(), slot,
+                [](const Flat& f, uint32_t s) { return f.slot < s; });
+            return (it != flats_.end() && it->slot == slot ?
+                long(it - flats_.begin()) : -1);
+        }
+
+        /**
+         * Determines whether the identifications in pairs_ form a forest on
+         * the given number of faces.  Pairs with the same key are counted
+         * once only.
+         */
+        bool forest(size_t faces) {
+            std::sort(pairs_.begin(), pairs_.end(),
+                [](const Pair& a, const Pair& b) { return a.key < b.key; });
+            uf_.resize(faces);
+            for (size_t i = 0; i < faces; ++i)
+                uf_[i] = int32_t(i);
+            for (size_t i = 0; i < pairs_.size(); ++i) {
+                if (i > 0 && pairs_[i].key == pairs_[i - 1].key)
+                    continue;
+                if (find(pairs_[i].a) == find(pairs_[i].b))
+                    return false;
+                unite(pairs_[i].a, pairs_[i].b);
+            }
+            return true;
+        }
+
+        /**
+         * Returns the two vertices of the given edge mask, in order.
+         */
+        static std::array<int, 2> localVertices(unsigned mask) {
+            std::array<int, 2> ans {};
+            int n = 0;
+            for (int v = 0; v < 5 && n < 2; ++v)
+                if (mask & (1 << v))
+                    ans[n++] = v;
+            return ans;
+        }
+
+        int32_t find(int32_t i) const {
+            while (uf_[i] != i)
+                i = uf_[i] = uf_[uf_[i]];
+            return i;
+        }
+
+        void unite(int32_t a, int32_t b) const {
+            a = find(a);
+            b = find(b);
+            if (a < b)
+                uf_[b] = a;
+            else if (b < a)
+                uf_[a] = b;
+        }
+
+#ifdef TRI4_VERIFY
+        /**
+         * Performs the given Pachner move both here and in regina, and
+         * aborts if the two disagree.
+         */
+        bool verifiedPachner(int32_t pent, unsigned mask) {
+            regina::Triangulation<4> ref = toRegina();
+            auto* p = ref.pentachoron(pent);
+            int v[3], nv = 0;
+            for (int i = 0; i < 5 && nv < 3; ++i)
+                if (mask & (1 << i))
+                    v[nv++] = i;
+            bool refOk;
+            switch (Tri4Faces::dim(mask)) {
+                case 4:
+                    refOk = ref.pachner(p, true, true);
+                    break;
+                case 3:
+                    refOk = ref.pachner(p->tetrahedron(
+                        tri4Faces.index[31 & ~mask]), true, true);
+                    break;
+                case 2:
+                    refOk = ref.pachner(p->triangle(
+                        regina::Triangle<4>::triangleNumber[v[0]][v[1]][v[2]]),
+                        true, true);
+                    break;
+                default:
+                    return pachnerImpl(pent, mask, true);
+            }
+
+            bool ok = pachnerImpl(pent, mask, true);
+            compare("Pachner move", pent, mask, ok, refOk, ref);
+            return ok;
+        }
+
+        /**
+         * Performs the given edge collapse (if collapse is true) or 2-0
+         * move both here and in regina, and aborts if the two disagree.
+         */
+        bool verifiedFlatten(int32_t pent, unsigned mask, bool collapse) {
+            regina::Triangulation<4> ref = toRegina();
+            auto* p = ref.pentachoron(pent);
+            int v[3], nv = 0;
+            for (int i = 0; i < 5 && nv < 3; ++i)
+                if (mask & (1 << i))
+                    v[nv++] = i;
+            bool refOk, ok;
+            if (collapse) {
+                refOk = ref.collapseEdge(p->edge(
+                    regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                ok = collapseEdgeImpl(pent, mask, true);
+            } else {
+                if (nv == 2)
+                    refOk = ref.twoZeroMove(p->edge(
+                        regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                else
+                    refOk = ref.twoZeroMove(p->triangle(
+                        regina::Triangle<4>::triangleNumber[v[0]][v[1]][v[2]]),
+                        true, true);
+                ok = twoZeroImpl(pent, mask, true);
+            }
+            compare(collapse ? "edge collapse" : "2-0 move", pent, mask, ok, refOk, ref);
+            return ok;
+        }
+
+        /**
+         * Aborts unless a move made here and the same move made in regina
+         * (giving ref) agree on legality and on the result.
+         */
+        void compare(const char* move, int32_t pent, unsigned mask, bool ok,
+                bool refOk, const regina::Triangulation<4>& ref) const {
+            if (ok != refOk || (ok && isoSig() !=
+                    ref.isoSig<regina::IsoSigEdgeDegrees<4>>())) {
+                std::cerr << "Tri4 disagrees with regina for the " << move <<
+                    " on mask " << mask << " of pentachoron " << pent << " in "
+                    << ref.isoSig<regina::IsoSigEdgeDegrees<4>>() << std::endl;
+                std::abort();
+            }
+        }
+#endif
+};
@@ -0,0 +1,215 @@
+#include "moveindex.h"
+#include "packedsig.h"
+#include <fstream>
+#include <iostream>
+
+/*
+Cross-checks Tri4 against regina on whole census files.
+
+For every isosig in each file, the triangulation is converted to a Tri4 and
+back again, and both copies must have the same gluings, the same numbers of
+faces and the same edge-degree isosig.  The packed isosig that regina builds
+through PackedSigEncoding must be the packed form of the printable isosig.
+Then every move used by the random walk (edge collapses, 2-0 moves about
+edges and triangles, 2-4 moves and 3-3 moves) is checked (and, where legal,
+performed) both by Tri4 and by regina: the two must agree on which moves
+are legal and on the isosigs of the results, and every legal move must be
+a candidate of MoveIndex.
+
+The program exits with status 0 only if no difference is found.
+*/
+
+/*
+# same gluings: whether a Tri4 and a regina triangulation are identical,
+# pentachoron for pentachoron and vertex for vertex
+*/
+bool sameGluings(const Tri4& tri, const regina::Triangulation<4>& ref) {
+    if (tri.size() != ref.size())
+        return false;
+    for (size_t p = 0; p < tri.size(); ++p)
+        for (int f = 0; f < 5; ++f) {
+            auto* q = ref.pentachoron(p)->adjacentSimplex(f);
+            if (tri.adjacent(p, f) != (q ? int32_t(q->index()) : -1))
+                return false;
+            if (q && tri.gluing(p, f) != ref.pentachoron(p)->adjacentGluing(f))
+                return false;
+        }
+    return true;
+}
+
+/*
+# check round trip: converts to Tri4 and back, and compares all three
+*/
+bool checkRoundTrip(const std::string& sig, const regina::Triangulation<4>& ref, const Tri4& tri) {
+    regina::Triangulation<4> back = tri.toRegina();
+    const char* problem = nullptr;
+    if (! sameGluings(tri, ref) || ! sameGluings(tri, back))
+        problem = "gluings differ";
+    else if (tri.countVertices() != ref.countVertices() ||
+            tri.countEdges() != ref.countEdges() ||
+            tri.countTriangles() != ref.countTriangles() ||
+            tri.countTetrahedra() != ref.countTetrahedra())
+        problem = "face counts differ";
+    else if (tri.isoSig() != ref.isoSig<regina::IsoSigEdgeDegrees<4>>() ||
+            back.isoSig<regina::IsoSigEdgeDegrees<4>>() != ref.isoSig<regina::IsoSigEdgeDegrees<4>>())
+        problem = "isosigs differ";
+    if (problem)
+        std::cerr << sig << ": round trip through Tri4 fails, " << problem << "." << std::endl;
+    return ! problem;
+}
+
+/*
+# check packed sig: compares the packed isosig from PackedSigEncoding with the
+# printable isosig
+*/
+bool checkPackedSig(const std::string& sig, const regina::Triangulation<4>& ref) {
+    std::string text = ref.isoSig<regina::IsoSigEdgeDegrees<4>>();
+    PackedSig packed = ref.isoSig<regina::IsoSigEdgeDegrees<4>,
+        PackedSigEncoding<4>>();
+    if (packed == PackedSig(text) && packed.text() == text)
+        return true;
+    std::cerr << sig << ": packed isosig " << packed.text() << " differs from " << text << "." << std::endl;
+    return false;
+}
+
+/*
+# check moves: tries the given move about every face of the right dimension
+# (edges for collapses and 2-0 edge moves, triangles for 3-3 and 2-0
+# triangle moves, tetrahedra for 2-4 moves) in both Tri4 and regina
+#
+# moves:	incremented by the number of moves that both found legal
+*/
+bool checkMoves(const std::string& sig, const regina::Triangulation<4>& ref, const Tri4& tri, MoveIndex::Move move, size_t& moves) {
+    MoveIndex index;
+    Tri4 indexed = tri;
+    index.refresh(indexed, true);
+    int dim;
+    const char* name;
+    switch (move) {
+        case MoveIndex::collapse: dim = 1; name = "edge collapse"; break;
+        case MoveIndex::twoZeroEdge: dim = 1; name = "2-0 edge move"; break;
+        case MoveIndex::threeThree: dim = 2; name = "3-3 move"; break;
+        case MoveIndex::twoZeroTriangle: dim = 2; name = "2-0 triangle move"; break;
+        default: dim = 3; name = "2-4 move"; break;
+    }
+
+    bool ans = true;
+    for (size_t f = 0; f < tri.countFaces(dim); ++f) {
+        auto e = tri.embedding(dim, f, 0);
+        unsigned mask = tri4Faces.mask[dim][e.face];
+        int v[3], nv = 0;
+        for (int i = 0; i < 5 && nv < 3; ++i)
+            if (mask & (1 << i))
+                v[nv++] = i;
+
+        Tri4 after = tri;
+        regina::Triangulation<4> refAfter = ref;
+        auto* p = refAfter.pentachoron(e.pent);
+        bool ok, refOk;
+        switch (move) {
+            case MoveIndex::collapse:
+                ok = after.collapseEdge(e.pent, mask);
+                refOk = refAfter.collapseEdge(p->edge(
+                    regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                break;
+            case MoveIndex::twoZeroEdge:
+                ok = after.twoZeroMove(e.pent, mask);
+                refOk = refAfter.twoZeroMove(p->edge(
+                    regina::Edge<4>::edgeNumber[v[0]][v[1]]), true, true);
+                break;
+            case MoveIndex::threeThree:
+                ok = after.pachner(e.pent, mask);
+                refOk = refAfter.pachner(p->triangle(
+                    regina::Triangle<4>::triangleNumber[v[0]][v[1]][v[2]]), true, true);
+                break;
+            case MoveIndex::twoZeroTriangle:
+                ok = after.twoZeroMove(e.pent, mask);
+                refOk = refAfter.twoZeroMove(p->triangle(
+                    regina::Triangle<4>::triangleNumber[v[0]][v[1]][v[2]]), true, true);
+                break;
+            default:
+                ok = after.pachner(e.pent, mask);
+                refOk = refAfter.pachner(p->tetrahedron(e.face), true, true);
+                break;
+        }
+
+        const char* problem = nullptr;
+        if (ok != refOk)
+            problem = (ok ? "only Tri4 finds it legal" : "only regina finds it legal");
+        else if (ok && after.isoSig() != refAfter.isoSig<regina::IsoSigEdgeDegrees<4>>())
+            problem = "the results differ";
+        else if (ok && ! sameGluings(after, after.toRegina()))
+            problem = "the result does not survive a round trip";
+        else if (ok) {
+            bool listed = false;
+            for (const auto& c : index.candidates(move))
+                if (c.pent == e.pent && c.mask == mask)
+                    listed = true;
+            if (! listed)
+                problem = "MoveIndex does not list it";
+        }
+        if (problem) {
+            std::cerr << sig << ": " << name << " on mask " << mask << " of pentachoron " << e.pent << ": " << problem << "." << std::endl;
+            ans = false;
+        } else if (ok)
+            ++moves;
+    }
+    return ans;
+}
+
+void usage(const char* progName, const std::string& error = std::string()) {
+    if (!error.empty()) {
+        std::cerr << error << "\n\n";
+    }
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "      " << progName << " [ census files ... ]\n";
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-')
+            files.push_back(argv[i]);
+        else
+            usage(argv[0], std::string("Invalid Option: ") + argv[i]);
+    }
+    if (files.empty())
+        files = { "Census/2p-closedOrientable.esig",
+            "Census/4p-closedOrientable.esig" };
+
+    size_t failed = 0;
+    for (const char* file : files) {
+        std::ifstream in(file);
+        if (! in)
+            usage(argv[0], std::string("Error: Cannot open ") + file);
+        size_t tris = 0, moves = 0;
+        std::string sig;
+        while (in >> sig) {
+            regina::Triangulation<4> ref;
+            try {
+                ref = regina::Triangulation<4>::fromIsoSig(sig);
+            } catch (const std::exception&) {
+                std::cerr << sig << ": not a valid isosig." << std::endl;
+                ++failed;
+                continue;
+            }
+            Tri4 tri(ref);
+            bool ok = checkRoundTrip(sig, ref, tri);
+            ok = checkPackedSig(sig, ref) && ok;
+            for (auto m : { MoveIndex::collapse, MoveIndex::threeThree, MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle, MoveIndex::twoFour })
+                ok = checkMoves(sig, ref, tri, m, moves) && ok;
+            if (! ok)
+                ++failed;
+            ++tris;
+        }
+        std::cout << file << ": " << tris << " triangulations, " << moves << " legal moves checked." << std::endl;
+    }
+
+    std::cout << failed << " triangulations failed." << std::endl;
+    if (failed == 0) {
+        std::cout << "TRI4 AGREES WITH REGINA." << std::endl;
+        return 0;
+    }
+    return 1;
+}
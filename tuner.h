@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <time.h>
+
+/**
+ * The parameters of a random walk, as passed to step().
+ */
+struct WalkParams {
+    double xx; // threshold to try a 3-3 move
+    int balance; // preferred size
+    double scaling; // aggressiveness of the pull towards balance
+    int upperBound; // no 2-4 or 1-5 moves beyond this size
+};
+
+inline std::ostream& operator << (std::ostream& out, const WalkParams& p) {
+    return out << "xx " << p.xx << ", balance " << p.balance <<
+        ", scaling " << p.scaling << ", upper bound " << p.upperBound;
+}
+
+/**
+ * Returns the CPU time used by the calling thread so far, in seconds.
+ */
+inline double threadSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Chooses walk parameters online so as to maximise the number of merges
+ * per CPU-second.
+ *
+ * This is a multi-armed bandit over a small grid of parameter settings
+ * around the hand-tuned defaults.  Each arm keeps the number of walks,
+ * the number of walks that merged two components, and the CPU time spent.
+ * The next walk uses the arm with the best optimistic rate, i.e., an upper
+ * confidence bound on its probability of a merge divided by its mean cost
+ * per walk; arms that have never been tried go first, and an arm with
+ * walks still in flight is only chosen again once every other arm has
+ * been tried.  If no arm has finished a walk yet and every arm has a walk
+ * in flight, the arm with the fewest walks in flight is chosen.
+ *
+ * Merges become rarer as components disappear, so all statistics decay by
+ * a constant factor with every recorded walk, and old evidence is slowly
+ * forgotten.
+ *
+ * choose() and record() may be called from any thread.
+ */
+// Heavyweight class, do not copy!
+class WalkTuner {
+    private:
+        struct Arm {
+            WalkParams params;
+            double walks { 0 };
+            double merges { 0 };
+            double seconds { 0 };
+            int pending { 0 }; // walks chosen but not yet recorded
+        };
+
+        std::vector<Arm> arms_;
+        double discount_;
+        double total_ { 0 }; // discounted number of walks over all arms
+
+        mutable std::mutex mutex_;
+
+    public:
+        /**
+         * Creates a tuner for walks towards triangulations with the given
+         * number of pentachora.
+         */
+        WalkTuner(int pentachora, double discount = 0.999) :
+                discount_(discount) {
+            for (double xx : { 0.05, 0.1, 0.2 })
+                for (int balance : { 2 * pentachora - 3, 2 * pentachora,
+                        2 * pentachora + 3 })
+                    for (double scaling : { 0.9, 1.0 })
+                        for (int upperBound : { 4 * pentachora, 9999 })
+                            arms_.push_back({ { xx, balance, scaling,
+                                upperBound } });
+        }
+
+        /**
+         * Returns the number of parameter settings.
+         */
+        size_t size() const {
+            return arms_.size();
+        }
+
+        const WalkParams& params(int arm) const {
+            return arms_[arm].params;
+        }
+
+        /**
+         * Returns the arm to use for the next walk.
+         */
+        int choose() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            int ans = -1, fewest = 0;
+            double bestScore = -1;
+            for (size_t i = 0; i < arms_.size(); ++i) {
+                const Arm& a = arms_[i];
+                if (a.walks == 0) {
+                    if (a.pending == 0) {
+                        ans = i;
+                        break;
+                    }
+                    if (a.pending < arms_[fewest].pending)
+                        fewest = i;
+                    continue;
+                }
+                double p = std::min(1.0, a.merges / a.walks +
+                    std::sqrt(2 * std::log(total_) / a.walks));
+                double score = p * a.walks / std::max(a.seconds, 1e-9);
+                if (score > bestScore) {
+                    bestScore = score;
+                    ans = i;
+                }
+            }
+            if (ans < 0)
+                ans = fewest;
+            ++arms_[ans].pending;
+            return ans;
+        }
+
+        /**
+         * Records the outcome of a walk with an arm returned by choose().
+         */
+        void record(int arm, bool merged, double seconds) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (Arm& a : arms_) {
+                a.walks *= discount_;
+                a.merges *= discount_;
+                a.seconds *= discount_;
+            }
+            total_ = total_ * discount_ + 1;
+            Arm& a = arms_[arm];
+            --a.pending;
+            a.walks += 1;
+            a.seconds += seconds;
+            if (merged)
+                a.merges += 1;
+        }
+
+        /**
+         * Returns the arm with the best observed merges per CPU-second.
+         */
+        int best() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            int ans = 0;
+            double bestRate = -1;
+            for (size_t i = 0; i < arms_.size(); ++i) {
+                double rate = arms_[i].merges / std::max(arms_[i].seconds, 1e-9);
+                if (rate > bestRate) {
+                    bestRate = rate;
+                    ans = i;
+                }
+            }
+            return ans;
+        }
+
+        /**
+         * Writes the current estimates of every arm, one per line.
+         */
+        void report(std::ostream& out) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const Arm& a : arms_)
+                out << a.params << ": " << a.merges << " merges in " <<
+                    a.walks << " walks, " << a.seconds << " seconds\n";
+            out.flush();
+        }
+
+        WalkTuner(const WalkTuner&) = delete;
+        WalkTuner& operator = (const WalkTuner&) = delete;
+};
@@ -0,0 +1,111 @@
+#include "boilerplate.h"
+#include "certificate.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+/*
+Checks a classification recorded by main with --certificates=FILE.
+
+Every certificate is replayed from its starting isosig, in parallel, and
+the connections that it proves are then applied to a union-find over the
+census, in the order in which they were recorded.  No search is involved,
+so this is much cheaper than the classification itself.
+
+The program exits with status 0 only if every certificate checks out and
+the census ends up as a single component.
+*/
+
+void usage(const char* progName, const std::string& error = std::string()) {
+    if (!error.empty()) {
+        std::cerr << error << "\n\n";
+    }
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "      " << progName << " { census file } { certificate files ... } [ -j=threads ] [ --disk=directory[:MiB] ]\n";
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned threads = 1;
+    std::vector<const char*> files;
+    std::string diskDir;
+    size_t diskMiB = 1024;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-')
+            files.push_back(argv[i]);
+        else if (std::strncmp(argv[i], "--disk=", 7) == 0) {
+            // keep the census on disk, as for main
+            std::string spec = argv[i] + 7;
+            size_t colon = spec.rfind(':');
+            diskDir = spec.substr(0, colon);
+            if (colon != std::string::npos)
+                diskMiB = std::stoul(spec.substr(colon + 1));
+        }
+        else if (argv[i][1] == 'j')
+            // -j on its own means one thread per core
+            threads = (argv[i][2] ? std::stoi(argv[i] + 2) :
+                std::thread::hardware_concurrency());
+        else
+            usage(argv[0], std::string("Invalid Option: ") + argv[i]);
+    }
+    if (files.size() < 2)
+        usage(argv[0], "Error: No census file or no certificates provided.");
+    threads = std::max(1u, threads);
+
+    TriangulationSet census;
+    std::vector<Certificate> certs;
+    try {
+        if (! diskDir.empty())
+            census.storeOnDisk(diskDir, diskMiB << 20);
+        census.read(files[0], threads);
+        for (size_t i = 1; i < files.size(); ++i)
+            readCertificates(files[i], certs);
+    } catch (const std::exception& e) {
+        usage(argv[0], e.what());
+    }
+    std::cout << census.size() << " triangulations in " << census.countComponents() << " components, " << certs.size() << " certificates." << std::endl;
+
+    // Replay every certificate.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> ok(certs.size(), false);
+    std::atomic<size_t> next { 0 };
+    auto work = [&]() {
+        for (size_t i = next++; i < certs.size(); i = next++)
+            ok[i] = verifyCertificate(certs[i]);
+    };
+    if (threads == 1)
+        work();
+    else {
+        std::vector<std::thread> pool;
+        for (unsigned i = 0; i < threads; ++i)
+            pool.emplace_back(work);
+        for (auto& t : pool)
+            t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Apply the connections, in the order in which they were found.
+    size_t failed = 0, moves = 0;
+    for (size_t i = 0; i < certs.size(); ++i) {
+        moves += certs[i].moves.size();
+        Component c = census.find(certs[i].start);
+        if (! ok[i] || ! c) {
+            // Without a certified route to its start, a certificate proves
+            // nothing about the census.
+            std::cerr << "Certificate " << i << " from " << certs[i].start << (ok[i] ? " starts outside the census." : " is invalid.") << std::endl;
+            ++failed;
+            continue;
+        }
+        census.mergeSig(c, certs[i].end, false);
+    }
+
+    std::cout << moves << " moves replayed in " << elapsed.count() << " seconds, " << failed << " certificates failed." << std::endl;
+    std::cout << "The certificates leave " << census.countComponents() << " components." << std::endl;
+    if (failed == 0 && census.countComponents() == 1) {
+        std::cout << "CLASSIFICATION VERIFIED." << std::endl;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,572 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "boilerplate.h"
+#include "certificate.h"
+#include "moveindex.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "walkpool.h"
+#include "xoshiro.h"
+
+/*
+Random walks through the Pachner graph, shared by main.cc and bench.cc.
+*/
+
+// Global variables to be place in proper place later.
+inline int targetVertices = -1;
+inline int targetPentachora = -1;
+
+/* uniform random number in [0,1), from this thread's stream (see seedWalks()) */
+inline double randd() {
+	return walkRandom().uniform();
+}
+
+/* penalty for moving away from balance */
+inline double beta(int n, int balance, double scaling) {
+	double ans;
+	(double)balance;
+	(double)n;
+		
+	ans = exp(scaling*(balance-n));
+	ans = ans/(1+ans);
+	return ans;
+}
+
+/*
+# pick move: pick move to eventually change number of vertices
+#
+# tri:		state triangulation
+# index:	legal moves in tri; refreshed here before use
+# xx:		threshold to try 3-3-move (in G(x,y) we have xx = 1 - 2(x+y))
+# b:		threshold to do 2-4- over 2-0-move (edge or triangle)
+# verts:	target number of vertices
+#
+# Each kind of move is chosen uniformly at random among the legal
+# candidates of that kind, instead of trying faces in order.
+*/
+inline bool perform(Tri4& tri, MoveIndex& index, double xx, double b, int verts, int lowerBound, int upperBound) {
+	STATS_COUNT(statPerformCalls);
+	int v = tri.countVertices();
+	double x, y;
+
+	if (v < verts) {
+		// 1-5 move, which is always legal
+		return index.apply(tri, MoveIndex::oneFive, { 0, 31, 0 });
+	}
+
+	index.refresh(tri);
+	if (v > verts) {
+		// try edge collapse
+		if (index.perform(tri, { MoveIndex::collapse }, randd)) {
+			return true;
+		}
+	}
+	// edge collapse failed
+	x = randd();
+	if (x > xx && tri.size() >= lowerBound) {
+		// try 3-3 move
+		if (index.perform(tri, { MoveIndex::threeThree }, randd)) {
+			return true;
+		}
+	}
+	// 3-3-move not executed, check if 2-0-move should be performed
+	y = randd();
+	if (y > b && tri.size() >= lowerBound) {
+		// case very likely if state is larger than target
+		// try going down using 2-0 edge or triangle moves
+		if (index.perform(tri, { MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle }, randd)) {
+			return true;
+		}
+	}
+	// 2-0-move not executed, try 2-4-move instead
+	if (tri.size() <= upperBound-2) {
+		if (index.perform(tri, { MoveIndex::twoFour }, randd)) {
+			return true;
+		}
+	} else {
+		// no 2-4 move because we reached upper bound:
+		// try other move (3-3 or 2-0)
+		if (index.perform(tri, { MoveIndex::threeThree }, randd)) {
+			return true;
+		}
+		if (index.perform(tri, { MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle }, randd)) {
+			return true;
+		}
+	}
+
+	// nothing worked: make sure that no stale entry in the index is hiding
+	// a legal 2-4 move before we give up
+	index.refresh(tri, true);
+	if (index.perform(tri, { MoveIndex::twoFour }, randd))
+		return true;
+	STATS_COUNT(statPerformFailed);
+	return false;
+}
+
+
+
+
+/*
+# restart policy: how many moves step() may make before starting again
+#
+# Each attempt of a walk gets a budget of moves.  An attempt that runs out
+# of budget is abandoned, and the walk starts again from its original
+# state with the budget for the next attempt:
+#
+# none:		no budget at all (the walk runs until it succeeds)
+# fixed:	the same budget every time
+# geometric:	the budget doubles with every attempt
+# luby:		the budget follows the Luby sequence 1,1,2,1,1,2,4,1,1,2,...
+#		times the base budget
+#
+# After maxRestarts restarts the walk gives up altogether (never, if
+# maxRestarts is negative).
+*/
+struct RestartPolicy {
+	enum Kind { none, fixed, geometric, luby };
+
+	Kind kind = none;
+	uint64_t base = 0;
+	int maxRestarts = -1;
+
+	/* budget for the given attempt (counting from 0), or 0 for no budget */
+	uint64_t budget(int attempt) const {
+		switch (kind) {
+			case fixed:
+				return base;
+			case geometric:
+				return base << std::min(attempt, 40);
+			case luby: {
+				// the Luby sequence, for i = attempt + 1
+				uint64_t i = attempt + 1;
+				while (true) {
+					int k = 1;
+					while (((uint64_t(1) << k) - 1) < i)
+						++k;
+					if (i == (uint64_t(1) << k) - 1)
+						return base << (k - 1);
+					i -= (uint64_t(1) << (k - 1)) - 1;
+				}
+			}
+			default:
+				return 0;
+		}
+	}
+
+	/*
+	parse a policy of the form kind:base[:maxRestarts], e.g. luby:10000:50;
+	throws std::invalid_argument if spec is not of this form
+	*/
+	static RestartPolicy parse(const std::string& spec) {
+		RestartPolicy ans;
+		size_t c1 = spec.find(':');
+		std::string kind = spec.substr(0, c1);
+		if (kind == "none")
+			return ans;
+		if (kind == "fixed")
+			ans.kind = fixed;
+		else if (kind == "geometric")
+			ans.kind = geometric;
+		else if (kind == "luby")
+			ans.kind = luby;
+		else
+			throw std::invalid_argument("Unknown restart policy: " + spec);
+		if (c1 == std::string::npos)
+			throw std::invalid_argument("Restart policy needs a budget: " + spec);
+		size_t c2 = spec.find(':', c1 + 1);
+		ans.base = std::stoull(spec.substr(c1 + 1, c2 - c1 - 1));
+		if (c2 != std::string::npos)
+			ans.maxRestarts = std::stoi(spec.substr(c2 + 1));
+		if (ans.base == 0)
+			throw std::invalid_argument("Restart budget must be positive: " + spec);
+		return ans;
+	}
+};
+
+/*
+# target vertex: connect triangulation to a verts-vertex triangulation
+#
+# tri:		state triangulation
+# xx:		threshold to try 3-3-move (in G(x,y) we have xx = 1 - 2(x+y))
+# balance:	preferred size of triangulation
+# scaling:	parameter for severity of penalty to be off balance
+# seen:		if non-null, collects the isosigs of all target-size states the
+#		walk passes through before it stops (each one at most once)
+# filter:	if non-null, states that fail this filter are left out of seen
+#		without computing their isosigs
+# restarts:	if non-null, budgets for the walk; a walk that gives up
+#		returns false and leaves tri unchanged
+# path:		if non-null, every move of the walk is appended to path->moves,
+#		and path->seenAt records how many moves had been made when each
+#		state was added to seen (moves from abandoned attempts are
+#		dropped, together with the states they added to seen)
+*/
+inline bool step(regina::Triangulation<4>& tri, double xx, int balance, double scaling, int lowerBound, int upperBound, std::vector<std::string>* seen = nullptr, const FingerprintFilter* filter = nullptr, const RestartPolicy* restarts = nullptr, WalkPath* path = nullptr) {
+	STATS_COUNT(statWalks);
+	STATS_TIME(statTimeWalk);
+	int vertices = tri.countVertices();
+	int pentachora = tri.size();
+	bool res = false;
+	// steps
+	int st = 0;
+	// penalty
+	double b;
+	// legal moves, maintained across calls to perform()
+	MoveIndex index;
+	// the walk itself runs on a bare gluing array; tri is only updated on return
+	Tri4 state(tri);
+	// target-size states already added to seen
+	std::unordered_set<std::string> recorded;
+	// restarts so far, budget for this attempt (0 for none) and where it began
+	int restart = 0;
+	uint64_t budget = (restarts ? restarts->budget(0) : 0);
+	int attemptStart = 0;
+	// where this walk's moves and states begin, for restarts
+	size_t pathBase = 0, seenBase = (seen ? seen->size() : 0);
+	if (path) {
+		index.log(&path->moves);
+		pathBase = path->moves.size();
+		path->seenAt.clear();
+	}
+		
+	while (true) {
+		st++;
+		b = beta(pentachora,balance,scaling);
+		res = perform(state,index,xx,b,targetVertices,lowerBound,upperBound);
+		if (not res) {
+			std::cout <<  "found bad triangulations" << std::endl;
+			tri = state.toRegina();
+			STATS_WALK(st);
+			return false;
+		}
+		//std::cout << state.isoSig() << "\t" << state.countVertices() << std::endl;
+		vertices = state.countVertices();
+		pentachora = state.size();
+		if (lowerBound < targetPentachora) {
+			if (vertices == targetVertices && pentachora==targetPentachora) {
+				//std::cout <<  st << std::endl;
+				tri = state.toRegina();
+				if (budget)
+					STATS_ATTEMPT(budget, true);
+				STATS_COUNT(statWalksFound);
+				STATS_WALK(st);
+				return true; }
+		} else {
+			if (vertices == targetVertices && pentachora==lowerBound) {
+				//std::cout <<  st << std::endl;
+				tri = state.toRegina();
+				if (budget)
+					STATS_ATTEMPT(budget, true);
+				STATS_COUNT(statWalksFound);
+				STATS_WALK(st);
+				return true; }
+		}
+		if (seen && vertices == targetVertices && pentachora == targetPentachora &&
+				(! filter || filter->mayContain(fingerprint(state)))) {
+			std::string sig = state.isoSig();
+			if (recorded.insert(sig).second) {
+				seen->push_back(std::move(sig));
+				if (path)
+					path->seenAt.push_back(path->moves.size());
+			}
+		}
+		if (budget && uint64_t(st - attemptStart) >= budget) {
+			// out of budget: abandon this attempt and start again
+			STATS_ATTEMPT(budget, false);
+			if (restarts->maxRestarts >= 0 && restart >= restarts->maxRestarts) {
+				STATS_COUNT(statWalksGaveUp);
+				STATS_WALK(st);
+				// drop the abandoned attempt, as for a restart
+				if (path) {
+					path->moves.resize(pathBase);
+					path->seenAt.clear();
+					if (seen)
+						seen->resize(seenBase);
+				}
+				return false;
+			}
+			STATS_COUNT(statRestarts);
+			budget = restarts->budget(++restart);
+			attemptStart = st;
+			state = Tri4(tri);
+			vertices = state.countVertices();
+			pentachora = state.size();
+			if (path) {
+				path->moves.resize(pathBase);
+				path->seenAt.clear();
+				if (seen) {
+					seen->resize(seenBase);
+					recorded.clear();
+				}
+			}
+		}
+		if (st%5000000 == 0) {
+			std::cout <<  st << "\t v: " << vertices << "\t p: " << pentachora << std::endl;
+		}
+	}
+	return false;			
+}
+
+
+/*
+# beam: best-first search for a target-size triangulation, as an alternative to step()
+#
+# tri:		start state; replaced by the state the search ends in
+# width:	number of states kept from one level to the next
+# depth:	number of levels (i.e., moves) after which the search gives up
+# lowerBound, upperBound:	as for step()
+# seen, filter:	as for step(), except that seen is left alone if path is
+#		given, since the states of a beam do not lie on a single path
+# path:		if non-null, the moves from tri to the state the search ends
+#		in are appended to path->moves
+#
+# Each level expands every state in the beam by every move that perform()
+# could make from it (just the 1-5 move while the state has too few
+# vertices), and keeps the width children with the lowest score
+#
+#	|vertices - target| + |pentachora - target| / 2 + novelty
+#
+# where novelty counts how often a state with the same fingerprint has
+# already been kept, so that the search does not circle on a plateau.  A
+# little noise breaks ties, so that repeated searches differ.
+#
+# Returns true as soon as some state reaches the target size of step() and
+# differs from every target-size state seen before; tri is then that state.
+# Otherwise tri becomes the best state of the last level, so that the next
+# search from the same component carries on from there.
+*/
+inline bool beam(regina::Triangulation<4>& tri, int width, int depth, int lowerBound, int upperBound, std::vector<std::string>* seen = nullptr, const FingerprintFilter* filter = nullptr, WalkPath* path = nullptr) {
+	STATS_COUNT(statBeams);
+	STATS_TIME(statTimeBeam);
+	int pentachora = (lowerBound < targetPentachora ? targetPentachora : lowerBound);
+	if (path) {
+		seen = nullptr;
+		path->seenAt.clear();
+	}
+
+	// a state in the beam, with the moves that led to it from tri
+	struct Node {
+		Tri4 state;
+		std::vector<uint32_t> moves;
+	};
+	// a child of some state in the beam, not yet built
+	struct Child {
+		double score;
+		size_t parent;
+		uint32_t move; // encoded by MoveIndex::encode()
+		uint64_t print;
+	};
+	std::vector<Node> level, next;
+	level.push_back({ Tri4(tri), {} });
+	std::vector<Child> children;
+	// how often a state with each fingerprint has been kept
+	std::unordered_map<uint64_t, uint32_t> kept;
+	// fingerprints of the states kept for the next level
+	std::unordered_set<uint64_t> taken;
+	kept[fingerprint(level[0].state)] = 1;
+	// target-size states already reached
+	std::unordered_set<std::string> recorded;
+	if (int(tri.countVertices()) == targetVertices && int(tri.size()) == pentachora)
+		recorded.insert(tri.isoSig<regina::IsoSigEdgeDegrees<4>>());
+	MoveIndex index, replay;
+
+	for (int d = 0; d < depth && ! level.empty(); ++d) {
+		children.clear();
+		for (size_t i = 0; i < level.size(); ++i) {
+			Tri4& state = level[i].state;
+			STATS_COUNT(statBeamStates);
+			std::vector<std::pair<MoveIndex::Move, MoveIndex::Candidate>> moves;
+			if (int(state.countVertices()) < targetVertices)
+				moves.push_back({ MoveIndex::oneFive, { 0, 31, 0 } });
+			else {
+				index.refresh(state, true);
+				for (auto m : { MoveIndex::collapse, MoveIndex::threeThree, MoveIndex::twoZeroEdge, MoveIndex::twoZeroTriangle, MoveIndex::twoFour }) {
+					if (m == MoveIndex::twoFour ? state.size() + 2 > size_t(upperBound) :
+							m != MoveIndex::collapse && state.size() < size_t(lowerBound))
+						continue;
+					for (const auto& c : index.candidates(m))
+						moves.push_back({ m, c });
+				}
+			}
+
+			for (const auto& mc : moves) {
+				// try the move in place, and take it back once scored
+				size_t before = state.mark();
+				if (! index.apply(state, mc.first, mc.second))
+					continue;
+				int v = state.countVertices();
+				int n = state.size();
+				if (v == targetVertices && n == pentachora) {
+					std::string sig = state.isoSig();
+					if (recorded.insert(sig).second) {
+						// a new target-size state: done
+						level[i].moves.push_back(MoveIndex::encode(mc.first, mc.second));
+						if (path)
+							path->moves.insert(path->moves.end(), level[i].moves.begin(), level[i].moves.end());
+						tri = state.toRegina();
+						STATS_COUNT(statBeamsFound);
+						return true;
+					}
+				} else if (seen && v == targetVertices && n == targetPentachora &&
+						(! filter || filter->mayContain(fingerprint(state)))) {
+					std::string sig = state.isoSig();
+					if (recorded.insert(sig).second)
+						seen->push_back(std::move(sig));
+				}
+				uint64_t print = fingerprint(state);
+				auto k = kept.find(print);
+				double score = std::abs(v - targetVertices) + std::abs(n - pentachora) / 2.0 +
+					(k == kept.end() ? 0 : k->second) + 0.1 * randd();
+				children.push_back({ score, i, MoveIndex::encode(mc.first, mc.second), print });
+				state.undo(before);
+			}
+			state.clearJournal();
+		}
+
+		// keep the best children, at most one for each fingerprint
+		std::sort(children.begin(), children.end(), [](const Child& a, const Child& b) {
+			return a.score < b.score;
+		});
+		next.clear();
+		taken.clear();
+		for (const Child& c : children) {
+			if (next.size() >= size_t(width))
+				break;
+			if (! taken.insert(c.print).second)
+				continue;
+			++kept[c.print];
+			MoveIndex::Move m;
+			MoveIndex::Candidate cand;
+			MoveIndex::decode(c.move, m, cand);
+			Node node { level[c.parent].state, level[c.parent].moves };
+			replay.apply(node.state, m, cand);
+			node.moves.push_back(c.move);
+			next.push_back(std::move(node));
+		}
+		if (next.empty())
+			break;
+		level.swap(next);
+	}
+
+	// out of depth: carry on from the best state next time
+	if (path)
+		path->moves.insert(path->moves.end(), level[0].moves.begin(), level[0].moves.end());
+	tri = level[0].state.toRegina();
+	return false;
+}
+
+/*
+# merge walk: merge everything a finished walk has connected to its component
+#
+# Any intermediate states reported by the walk (see step()) that are already
+# in the census are merged before the state the walk ended in.  If certs is
+# non-null, a certificate is written for every merge.  Returns true if the
+# walk merged anything.  Throws std::runtime_error if a certificate cannot be
+# written.
+*/
+inline bool mergeWalk(TriangulationSet& census, const WalkJob& job, CertificateWriter* certs) {
+	bool res = false;
+	for (size_t i = 0; i < job.seen.size(); ++i)
+		if (census.mergeIfPresent(job.comp, job.seen[i])) {
+			res = true;
+			if (certs && i < job.path.seenAt.size())
+				certs->add(job.start, job.seen[i], job.path.moves.data(), job.path.seenAt[i]);
+		}
+	if (census.merge(job.comp,job.tri,false)) {
+		res = true;
+		if (certs)
+			certs->add(job.start, job.tri.isoSig<regina::IsoSigEdgeDegrees<4>>(), job.path.moves.data(), job.path.moves.size());
+	}
+	return res;
+}
+
+/*
+# sweep: walk from every current component, spreading the walks over a pool
+#
+# census:	triangulation set; only ever modified on the calling thread
+# pool:		workers that run step() from each component's representative
+# walks:	maximum number of walks from a component whose walks do not merge
+# stopAt:	stop handing out work once this many components remain
+# onResult:	called after each walk with true if the walk merged anything
+# certs:	if non-null, a certificate is written for every merge; the
+#		walker must then record each job's path (see step())
+#
+# Walks from a single component are carried out one after another, each
+# continuing from where the last one ended, exactly as in the serial loops.
+# All merges happen here (see mergeWalk()), in the order in which walks
+# complete.
+*/
+template <typename Callback>
+void sweep(TriangulationSet& census, WalkPool& pool, int walks, size_t stopAt, Callback&& onResult, CertificateWriter* certs = nullptr) {
+	std::vector<Component> order;
+	for (Component c = census.components(); c; ++c)
+		order.push_back(c);
+
+	size_t next = 0;
+	while (true) {
+		while (next < order.size() && pool.inFlight() < pool.capacity() &&
+				census.countComponents() > stopAt) {
+			Component c = order[next++];
+			// Another walk is already working on this component.
+			if (pool.busy(c))
+				continue;
+			WalkJob job { c, c.rep() };
+			if (certs)
+				job.start = c.repSig();
+			pool.submit(std::move(job));
+		}
+		if (pool.inFlight() == 0)
+			break;
+
+		WalkJob job = pool.collect();
+		bool res = mergeWalk(census, job, certs);
+		onResult(job, res);
+		if (! res && job.attempts < walks && census.countComponents() > stopAt)
+			pool.submit(std::move(job));
+	}
+}
+
+/*
+# schedule: walk from the components in order of priority until at most stopAt remain
+#
+# census:	triangulation set; only ever modified on the calling thread
+# pool:		workers that run step() from each component
+# scheduler:	decides which component each walk starts from
+# stopAt, onResult, certs:	as for sweep()
+#
+# Unlike sweep(), this does not make a fixed number of walks from each
+# component in turn: the scheduler hands out the component that is due
+# next, and walks from components that have been merged away are dropped.
+# Returns early if the scheduler runs out of components, which only happens
+# if the census was modified behind its back, or if the scheduler has been
+# restricted to some components (see Scheduler) and has retired them all.
+*/
+template <typename Callback>
+void schedule(TriangulationSet& census, WalkPool& pool, Scheduler& scheduler, size_t stopAt, Callback&& onResult, CertificateWriter* certs = nullptr) {
+	while (true) {
+		while (pool.inFlight() < pool.capacity() && census.countComponents() > stopAt) {
+			WalkJob job;
+			if (! scheduler.next(job))
+				break;
+			if (certs && job.start.empty())
+				job.start = job.comp.repSig();
+			pool.submit(std::move(job));
+		}
+		if (pool.inFlight() == 0)
+			break;
+
+		WalkJob job = pool.collect();
+		bool res = mergeWalk(census, job, certs);
+		onResult(job, res);
+		scheduler.done(std::move(job), res);
+	}
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "boilerplate.h"
+#include "certificate.h"
+
+/**
+ * A single random walk through the Pachner graph, as handed to a WalkPool.
+ *
+ * The worker never touches comp; the component is carried along so that
+ * the merge stage knows where the walk came from.
+ */
+struct WalkJob {
+    Component comp; // component that the walk started from
+    regina::Triangulation<4> tri; // start state on submission, end state on collection
+    int attempts { 0 }; // number of walks completed from this component so far
+    bool ok { false }; // return value of the walker
+    std::vector<std::string> seen; // isosigs reported by the walker, cleared before each walk
+    uint32_t origin { 0 }; // caller-defined tag for the starting point, untouched by the pool
+    int arm { -1 }; // walk parameters chosen by the walker (see WalkTuner), or -1
+    double seconds { 0 }; // CPU time of the last walk, if measured by the walker
+    std::string start; // isosig of the state path starts from, if recording certificates
+    WalkPath path; // moves of all walks of this job so far, if recorded by the walker
+    size_t ticket { 0 }; // assigned by WalkPool::submit()
+};
+
+// Heavyweight class, do not copy!
+class WalkPool {
+    public:
+        using Walker = std::function<bool(WalkJob&)>;
+
+    private:
+        Walker walker_;
+        std::vector<std::thread> threads_;
+
+        std::mutex mutex_;
+        std::condition_variable jobReady_;
+        std::condition_variable resultReady_;
+        std::deque<WalkJob> jobs_;
+        std::deque<WalkJob> results_;
+        bool stop_ { false };
+
+        // Only ever touched by the thread that owns the pool:
+        std::vector<std::pair<size_t, Component>> active_; // walks in flight
+        size_t nextTicket_ { 0 };
+
+    public:
+        /**
+         * Creates a pool with the given number of worker threads, each of
+         * which runs the given walker on submitted jobs.  The walker may
+         * read and write everything in the job except for comp.
+         *
+         * If nThreads is 0 or 1 then no threads are started at all, and
+         * each job is walked on the calling thread inside collect().
+         */
+        WalkPool(unsigned nThreads, Walker walker) : walker_(std::move(walker)) {
+            if (nThreads > 1)
+                for (unsigned i = 0; i < nThreads; ++i)
+                    threads_.emplace_back([this]() { work(); });
+        }
+
+        ~WalkPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            jobReady_.notify_all();
+            for (auto& t : threads_)
+                t.join();
+        }
+
+        /**
+         * Returns the number of jobs that should be kept in flight to keep
+         * every worker busy.
+         */
+        size_t capacity() const {
+            return threads_.empty() ? 1 : 2 * threads_.size();
+        }
+
+        /**
+         * Returns the number of jobs submitted but not yet collected.
+         */
+        size_t inFlight() const {
+            return active_.size();
+        }
+
+        /**
+         * Determines whether some job in flight started from the given
+         * component.  Since components may have been merged since the
+         * job was submitted, this compares components, not nodes.
+         */
+        bool busy(const Component& c) const {
+            for (const auto& a : active_)
+                if (a.second == c)
+                    return true;
+            return false;
+        }
+
+        /**
+         * Hands the given job to the workers.
+         */
+        void submit(WalkJob&& job) {
+            job.ticket = nextTicket_++;
+            active_.emplace_back(job.ticket, job.comp);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(std::move(job));
+            }
+            jobReady_.notify_one();
+        }
+
+        /**
+         * Waits for some job to finish and returns it, in whatever order the
+         * workers complete them.
+         *
+         * PRE: inFlight() > 0.
+         */
+        WalkJob collect() {
+            WalkJob ans;
+            if (threads_.empty()) {
+                ans = std::move(jobs_.front());
+                jobs_.pop_front();
+                run(ans);
+            } else {
+                std::unique_lock<std::mutex> lock(mutex_);
+                resultReady_.wait(lock, [this]() { return ! results_.empty(); });
+                ans = std::move(results_.front());
+                results_.pop_front();
+            }
+
+            for (auto it = active_.begin(); it != active_.end(); ++it)
+                if (it->first == ans.ticket) {
+                    active_.erase(it);
+                    break;
+                }
+            return ans;
+        }
+
+        WalkPool(const WalkPool&) = delete;
+        WalkPool& operator = (const WalkPool&) = delete;
+
+    private:
+        void run(WalkJob& job) {
+            job.seen.clear();
+            job.ok = walker_(job);
+            ++job.attempts;
+        }
+
+        void work() {
+            while (true) {
+                WalkJob job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    jobReady_.wait(lock,
+                        [this]() { return stop_ || ! jobs_.empty(); });
+                    if (stop_)
+                        return;
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
+                }
+                run(job);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    results_.push_back(std::move(job));
+                }
+                resultReady_.notify_one();
+            }
+        }
+};
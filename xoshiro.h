@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * The xoshiro256** generator of Blackman and Vigna: fast, small, and good
+ * enough for random walks.  jump() advances the generator by 2^128 steps,
+ * which splits a single seed into many non-overlapping streams.
+ */
+class Xoshiro256 {
+    private:
+        uint64_t s_[4];
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+    public:
+        Xoshiro256(uint64_t seed = 0) {
+            this->seed(seed);
+        }
+
+        /**
+         * Resets the state from the given seed, expanded with splitmix64.
+         */
+        void seed(uint64_t seed) {
+            for (uint64_t& s : s_) {
+                uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                s = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next() {
+            uint64_t ans = rotl(s_[1] * 5, 7) * 9;
+            uint64_t t = s_[1] << 17;
+            s_[2] ^= s_[0];
+            s_[3] ^= s_[1];
+            s_[1] ^= s_[2];
+            s_[0] ^= s_[3];
+            s_[2] ^= t;
+            s_[3] = rotl(s_[3], 45);
+            return ans;
+        }
+
+        /**
+         * Returns a uniform random number in [0,1).
+         */
+        double uniform() {
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        /**
+         * Advances the generator by 2^128 calls to next().
+         */
+        void jump() {
+            static const uint64_t poly[4] = { 0x180ec6d33cfd0abaull,
+                0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull,
+                0x39abdc4529b1661cull };
+            uint64_t t[4] = { 0, 0, 0, 0 };
+            for (uint64_t p : poly)
+                for (int b = 0; b < 64; ++b) {
+                    if (p & (uint64_t(1) << b))
+                        for (int i = 0; i < 4; ++i)
+                            t[i] ^= s_[i];
+                    next();
+                }
+            for (int i = 0; i < 4; ++i)
+                s_[i] = t[i];
+        }
+};
+
+// Shared state behind seedWalks() and walkRandom():
+inline std::atomic<uint64_t> walkSeed { 0 };
+inline std::atomic<uint64_t> walkGeneration { 0 }; // bumped by every seedWalks()
+inline std::atomic<uint64_t> walkThreads { 0 }; // streams handed out so far
+
+/**
+ * Seeds the random numbers used by all random walks.  Each thread draws
+ * from its own stream: the n-th thread to use walkRandom() gets the
+ * generator seeded with the given seed and jumped n times, so the streams
+ * never overlap and a single-threaded run is reproducible from its seed.
+ *
+ * Threads renumber themselves from firstStream (in order of first use)
+ * after every call, so that a process can be given streams of its own.
+ */
+inline void seedWalks(uint64_t seed, uint64_t firstStream = 0) {
+    walkSeed = seed;
+    walkThreads = firstStream;
+    ++walkGeneration;
+}
+
+/**
+ * Returns the calling thread's generator for random walks.
+ */
+inline Xoshiro256& walkRandom() {
+    struct Local {
+        Xoshiro256 rng;
+        uint64_t generation { uint64_t(-1) };
+    };
+    thread_local Local l;
+    uint64_t generation = walkGeneration.load(std::memory_order_relaxed);
+    if (l.generation != generation) {
+        l.rng.seed(walkSeed.load());
+        for (uint64_t n = walkThreads++; n > 0; --n)
+            l.rng.jump();
+        l.generation = generation;
+    }
+    return l.rng;
+}